@@ -3,7 +3,17 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Number of buckets in a latency histogram.  Bucket I counts
+   operations that took from 2**I to 2**(I+1) - 1 time stamp
+   counter cycles; the last one also counts anything slower. */
+#define LATENCY_BUCKETS 40
 
 /* A block device. */
 struct block
@@ -16,18 +26,46 @@ struct block
 
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
+    struct block_queue *queue;          /* Request queue, or null. */
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Per-operation statistics.  An operation is one call to
+       block_read(), block_write(), and so on, or one request. */
+    unsigned long long op_cnt[2];       /* Reads, writes carried out. */
+    unsigned long long seq_cnt;         /* Ops that continue the last. */
+    unsigned long long rand_cnt;        /* All other ops. */
+    block_sector_t next_sector;         /* Sector after the last op. */
+    uint64_t latency_sum;               /* Total latency in TSC cycles. */
+    unsigned long long latency[2][LATENCY_BUCKETS]; /* Read, write
+                                                       histograms. */
   };
 
 /* List of all block devices. */
 static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 
+/* List of all request queues. */
+static struct list all_queues = LIST_INITIALIZER (all_queues);
+
 /* The block block assigned to each Pintos role. */
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
+/* Time stamp counter when the first device was registered. */
+static uint64_t start_tsc;
+
 static struct block *list_elem_to_block (struct list_elem *);
+static void enqueue (struct block_queue *, struct block_request *);
+static void print_queue_stats (void);
+
+/* Returns the processor's time stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -113,6 +151,135 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Verifies that the CNT sectors starting at SECTOR all lie
+   within BLOCK.  Panics if not. */
+static void
+check_sectors (struct block *block, block_sector_t sector, size_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%zu, "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt,
+           block->size);
+}
+
+/* Carries out a transfer of CNT sectors starting at SECTOR
+   between BLOCK and BUFFER directly through BLOCK's driver, in
+   the calling thread. */
+static void
+do_transfer (struct block *block, bool write, block_sector_t sector,
+             size_t cnt, void *buffer)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (write && ops->write_multiple != NULL)
+    ops->write_multiple (block->aux, sector, cnt, buffer);
+  else if (!write && ops->read_multiple != NULL)
+    ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++, p += BLOCK_SECTOR_SIZE)
+      {
+        if (write)
+          ops->write (block->aux, sector + i, p);
+        else
+          ops->read (block->aux, sector + i, p);
+      }
+}
+
+/* Checks that a transfer of CNT sectors starting at SECTOR is
+   valid for BLOCK and counts it in BLOCK's statistics. */
+static void
+account (struct block *block, bool write, block_sector_t sector, size_t cnt)
+{
+  enum intr_level old_level;
+
+  check_sectors (block, sector, cnt);
+  ASSERT (!write || block->type != BLOCK_FOREIGN);
+
+  old_level = intr_disable ();
+  if (write)
+    block->write_cnt += cnt;
+  else
+    block->read_cnt += cnt;
+  block->op_cnt[write]++;
+  if (sector == block->next_sector)
+    block->seq_cnt++;
+  else
+    block->rand_cnt++;
+  block->next_sector = sector + cnt;
+  intr_set_level (old_level);
+}
+
+/* Records in BLOCK's statistics that an operation, a write if
+   WRITE is true and otherwise a read, which began when the time
+   stamp counter read START, has just completed.  May be called
+   from an interrupt handler. */
+static void
+record_latency (struct block *block, bool write, uint64_t start)
+{
+  uint64_t cycles = rdtsc () - start;
+  enum intr_level old_level;
+  int bucket = 0;
+
+  while (cycles >> (bucket + 1) != 0 && bucket < LATENCY_BUCKETS - 1)
+    bucket++;
+
+  old_level = intr_disable ();
+  block->latency_sum += cycles;
+  block->latency[write][bucket]++;
+  intr_set_level (old_level);
+}
+
+/* Completion function for synchronous requests: wakes up the
+   thread waiting on the semaphore in REQ's aux. */
+static void
+wake_waiter (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER and returns once the transfer is complete.  BUFFER goes
+   through BLOCK's request queue, if any, so that it is ordered
+   and merged with other requests.
+
+   BUFFER must be in kernel memory.  Drivers hand its physical
+   address to the device and sleep until the transfer is done, so
+   a user page that another thread unmapped in the meantime could
+   be reused while the device still writes to it.  System calls
+   pass user data through kernel buffers instead. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          size_t cnt, void *buffer)
+{
+  ASSERT (is_kernel_vaddr (buffer));
+
+  if (cnt == 0)
+    return;
+
+  if (block->queue != NULL || block->ops->submit != NULL)
+    {
+      struct block_request req;
+      struct semaphore done;
+
+      sema_init (&done, 0);
+      block_request_init (&req, write, sector, cnt, buffer,
+                          wake_waiter, &done);
+      block_submit (block, &req);
+      sema_down (&done);
+    }
+  else
+    {
+      uint64_t start = rdtsc ();
+
+      account (block, write, sector, cnt);
+      do_transfer (block, write, sector, cnt, buffer);
+      record_latency (block, write, start);
+    }
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +287,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  transfer (block, false, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +298,85 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  transfer (block, true, sector, 1, (void *) buffer);
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR from
+   BLOCK into BUFFER, which must have room for CNT *
+   BLOCK_SECTOR_SIZE bytes.  If the driver supports it, this is
+   done as a few large transfers instead of CNT small ones.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  transfer (block, false, sector, cnt, buffer);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data.  If the driver supports it, this is done as a few large
+   transfers instead of CNT small ones.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  transfer (block, true, sector, cnt, (void *) buffer);
+}
+
+/* Initializes REQ as a request to transfer CNT sectors starting
+   at SECTOR between a block device and BUFFER, which must be in
+   kernel memory: a write from BUFFER if WRITE is true, otherwise
+   a read into it.  Once the request is complete, COMPLETE, if
+   non-null, will be called with REQ.  AUX is stored in REQ for
+   COMPLETE's use. */
+void
+block_request_init (struct block_request *req, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_complete_func *complete, void *aux)
+{
+  req->block = NULL;
+  req->write = write;
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffer = buffer;
+  req->complete = complete;
+  req->aux = aux;
+  req->origin = NULL;
+}
+
+/* Submits REQ to BLOCK and returns, usually before the request
+   has been carried out.  REQ's completion function is called
+   once it has, possibly in another thread, in an interrupt
+   handler, or before this function returns, so it must not
+   sleep.  If
+   BLOCK is a partition, REQ's sector is translated to the
+   underlying device before completion. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  ASSERT (is_kernel_vaddr (req->buffer));
+
+  if (req->origin == NULL)
+    {
+      req->origin = block;
+      req->start = rdtsc ();
+    }
+  account (block, req->write, req->sector, req->cnt);
+  req->block = block;
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, req);
+  else if (block->queue != NULL)
+    enqueue (block->queue, req);
+  else
+    {
+      do_transfer (block, req->write, req->sector, req->cnt, req->buffer);
+      block_complete (req);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,6 +400,52 @@ block_type (struct block *block)
   return block->type;
 }
 
+/* Prints BLOCK's latency histogram for reads, if WRITE is false,
+   or for writes, as one line listing each bucket from the first
+   to the last that is nonempty. */
+static void
+print_latency (const struct block *block, bool write)
+{
+  const unsigned long long *hist = block->latency[write];
+  int first, last, i;
+
+  for (first = 0; first < LATENCY_BUCKETS && hist[first] == 0; first++)
+    continue;
+  if (first == LATENCY_BUCKETS)
+    return;
+  for (last = LATENCY_BUCKETS - 1; hist[last] == 0; last--)
+    continue;
+
+  printf ("  %s latency (log2 cycles):", write ? "write" : "read");
+  for (i = first; i <= last; i++)
+    printf (" %d:%llu", i, hist[i]);
+  printf ("\n");
+}
+
+/* Prints BLOCK's per-operation statistics.  The average queue
+   depth is the average number of BLOCK's operations in progress
+   at once since boot, that is, the total time they took divided
+   by the time elapsed. */
+static void
+print_op_stats (const struct block *block)
+{
+  unsigned long long op_cnt = block->op_cnt[0] + block->op_cnt[1];
+  uint64_t elapsed = rdtsc () - start_tsc;
+  uint64_t depth = elapsed != 0 ? block->latency_sum * 100 / elapsed : 0;
+
+  if (op_cnt == 0)
+    return;
+  printf ("  %llu read ops (%llu bytes), %llu write ops (%llu bytes)\n",
+          block->op_cnt[0], block->read_cnt * BLOCK_SECTOR_SIZE,
+          block->op_cnt[1], block->write_cnt * BLOCK_SECTOR_SIZE);
+  printf ("  %llu sequential, %llu random, "
+          "%llu cycles average latency, %llu.%02llu average queue depth\n",
+          block->seq_cnt, block->rand_cnt, block->latency_sum / op_cnt,
+          depth / 100, depth % 100);
+  print_latency (block, false);
+  print_latency (block, true);
+}
+
 /* Prints statistics for each block device used for a Pintos role. */
 void
 block_print_stats (void)
@@ -174,8 +460,10 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          print_op_stats (block);
         }
     }
+  print_queue_stats ();
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -198,8 +486,16 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
+  block->queue = NULL;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->op_cnt[0] = block->op_cnt[1] = 0;
+  block->seq_cnt = block->rand_cnt = 0;
+  block->next_sector = 0;
+  block->latency_sum = 0;
+  memset (block->latency, 0, sizeof block->latency);
+  if (start_tsc == 0)
+    start_tsc = rdtsc ();
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -210,6 +506,25 @@ block_register (const char *name, enum block_type type,
 
   return block;
 }
+
+/* Called by a driver, possibly from an interrupt handler, when
+   it has carried out REQ, to update statistics and call REQ's
+   completion function.  Afterward, REQ may be submitted again.
+   A driver may also use this for requests of its own that did
+   not go through block_submit(), which are not counted. */
+void
+block_complete (struct block_request *req)
+{
+  if (req->origin != NULL)
+    {
+      record_latency (req->origin, req->write, req->start);
+      if (req->block != req->origin)
+        record_latency (req->block, req->write, req->start);
+      req->origin = NULL;
+    }
+  if (req->complete != NULL)
+    req->complete (req);
+}
 
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
@@ -220,4 +535,259 @@ list_elem_to_block (struct list_elem *list_elem)
           ? list_entry (list_elem, struct block, list_elem)
           : NULL);
 }
+
+/* Request queues.
+
+   A queue holds the pending requests for one or more devices
+   that share a controller, and has a dispatcher thread that
+   carries them out one at a time through the devices' drivers.
+   Requests are served in C-SCAN order: in increasing order of
+   (device, sector) starting from the end of the last transfer,
+   then wrapping around to the lowest.  A request that continues
+   right where the one before it ends, in the same direction, is
+   merged with it into a single transfer. */
+
+/* A request queue. */
+struct block_queue
+  {
+    struct list_elem list_elem;         /* Element in all_queues. */
+    char name[16];                      /* Queue name, e.g. "ide0". */
+    struct lock lock;                   /* Guards the members below. */
+    struct condition not_empty;         /* Signaled on new requests. */
+    struct list requests;               /* Sorted by position. */
+    struct block *head_block;           /* C-SCAN position: device */
+    block_sector_t head_sector;         /* ...and sector. */
+
+    /* Statistics, updated only by the dispatcher. */
+    unsigned long long transfer_cnt;    /* Transfers carried out. */
+    unsigned long long request_cnt;     /* Requests carried out. */
+    unsigned long long sector_cnt;      /* Sectors transferred. */
+    int64_t busy_ticks;                 /* Timer ticks spent transferring. */
+  };
+
+/* Maximum number of sectors that the dispatcher merges into a
+   single transfer. */
+#define MAX_MERGE_SECTORS 256
+
+static thread_func dispatcher;
+
+/* Creates and returns a new request queue named NAME, including
+   its dispatcher thread.  Panics on failure. */
+struct block_queue *
+block_queue_create (const char *name)
+{
+  struct block_queue *q = malloc (sizeof *q);
+  if (q == NULL)
+    PANIC ("Failed to allocate memory for block request queue");
+
+  strlcpy (q->name, name, sizeof q->name);
+  lock_init (&q->lock);
+  cond_init (&q->not_empty);
+  list_init (&q->requests);
+  q->head_block = NULL;
+  q->head_sector = 0;
+  q->transfer_cnt = q->request_cnt = q->sector_cnt = 0;
+  q->busy_ticks = 0;
+  list_push_back (&all_queues, &q->list_elem);
 
+  if (thread_create (q->name, PRI_MAX, dispatcher, q) == TID_ERROR)
+    PANIC ("Failed to start dispatcher for %s", q->name);
+  return q;
+}
+
+/* Makes requests for BLOCK go through queue Q. */
+void
+block_set_queue (struct block *block, struct block_queue *q)
+{
+  block->queue = q;
+}
+
+/* Returns true if position (A, A_SECTOR) comes before (B,
+   B_SECTOR) in a sweep of the disk arm. */
+static bool
+position_less (const struct block *a, block_sector_t a_sector,
+               const struct block *b, block_sector_t b_sector)
+{
+  if (a != b)
+    return (uintptr_t) a < (uintptr_t) b;
+  return a_sector < b_sector;
+}
+
+/* Orders block_requests by position. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return position_less (a->block, a->sector, b->block, b->sector);
+}
+
+/* Adds REQ to queue Q and wakes its dispatcher. */
+static void
+enqueue (struct block_queue *q, struct block_request *req)
+{
+  lock_acquire (&q->lock);
+  list_insert_ordered (&q->requests, &req->elem, request_less, NULL);
+  cond_signal (&q->not_empty, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Returns the request in Q that comes next in C-SCAN order.  Q
+   must not be empty and its lock must be held. */
+static struct block_request *
+next_request (struct block_queue *q)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (!position_less (r->block, r->sector, q->head_block, q->head_sector))
+        return r;
+    }
+  return list_entry (list_front (&q->requests), struct block_request, elem);
+}
+
+/* Returns true if NEXT can be merged onto the end of a transfer
+   of CNT sectors whose last request is PREV. */
+static bool
+continues (const struct block_request *prev, const struct block_request *next,
+           size_t cnt)
+{
+  return (next->block == prev->block
+          && next->write == prev->write
+          && next->sector == prev->sector + prev->cnt
+          && cnt + next->cnt <= MAX_MERGE_SECTORS);
+}
+
+/* Carries out the CNT-sector transfer made of the requests in
+   BATCH, which continue one another, and completes them.  With
+   more than one request, gathers the data through a bounce
+   buffer so that the device sees a single transfer, unless
+   memory is short. */
+static void
+run_batch (struct list *batch, size_t cnt)
+{
+  struct block_request *first = list_entry (list_front (batch),
+                                            struct block_request, elem);
+  uint8_t *bounce = NULL;
+  struct list_elem *e;
+
+  if (list_begin (batch) != list_rbegin (batch))
+    bounce = malloc (cnt * BLOCK_SECTOR_SIZE);
+
+  if (bounce != NULL)
+    {
+      uint8_t *p;
+
+      if (first->write)
+        for (e = list_begin (batch), p = bounce; e != list_end (batch);
+             e = list_next (e))
+          {
+            struct block_request *r = list_entry (e, struct block_request,
+                                                  elem);
+            memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+            p += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+      do_transfer (first->block, first->write, first->sector, cnt, bounce);
+      if (!first->write)
+        for (e = list_begin (batch), p = bounce; e != list_end (batch);
+             e = list_next (e))
+          {
+            struct block_request *r = list_entry (e, struct block_request,
+                                                  elem);
+            memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+            p += r->cnt * BLOCK_SECTOR_SIZE;
+          }
+      free (bounce);
+    }
+  else
+    for (e = list_begin (batch); e != list_end (batch); e = list_next (e))
+      {
+        struct block_request *r = list_entry (e, struct block_request, elem);
+        do_transfer (r->block, r->write, r->sector, r->cnt, r->buffer);
+      }
+
+  /* A completion function may free its request, so unlink each
+     request before calling it. */
+  while (!list_empty (batch))
+    {
+      struct block_request *r = list_entry (list_pop_front (batch),
+                                            struct block_request, elem);
+      block_complete (r);
+    }
+}
+
+/* Dispatcher thread for the block_queue passed as Q_.  Takes
+   the next request in C-SCAN order, along with any requests
+   that continue it, and carries them out. */
+static void
+dispatcher (void *q_)
+{
+  struct block_queue *q = q_;
+
+  for (;;)
+    {
+      struct block_request *first, *last;
+      struct list_elem *e;
+      struct list batch;
+      size_t cnt = 0;
+      int64_t start;
+
+      list_init (&batch);
+      lock_acquire (&q->lock);
+      while (list_empty (&q->requests))
+        cond_wait (&q->not_empty, &q->lock);
+
+      first = next_request (q);
+      e = &first->elem;
+      for (;;)
+        {
+          last = list_entry (e, struct block_request, elem);
+          e = list_remove (e);
+          list_push_back (&batch, &last->elem);
+          cnt += last->cnt;
+          if (e == list_end (&q->requests)
+              || !continues (last, list_entry (e, struct block_request, elem),
+                             cnt))
+            break;
+        }
+      q->head_block = first->block;
+      q->head_sector = last->sector + last->cnt;
+      lock_release (&q->lock);
+
+      q->transfer_cnt++;
+      q->request_cnt += list_size (&batch);
+      q->sector_cnt += cnt;
+      start = timer_ticks ();
+      run_batch (&batch, cnt);
+      q->busy_ticks += timer_elapsed (start);
+    }
+}
+
+/* Prints statistics for each request queue, and the throughput
+   of all of them together.  Queues that are busy at the same
+   time, such as those of different IDE channels, add up to more
+   sectors per tick than any one of them alone. */
+static void
+print_queue_stats (void)
+{
+  unsigned long long sector_cnt = 0;
+  struct list_elem *e;
+
+  for (e = list_begin (&all_queues); e != list_end (&all_queues);
+       e = list_next (e))
+    {
+      struct block_queue *q = list_entry (e, struct block_queue, list_elem);
+      printf ("%s queue: %llu requests in %llu transfers, "
+              "%llu sectors in %"PRId64" busy ticks\n",
+              q->name, q->request_cnt, q->transfer_cnt,
+              q->sector_cnt, q->busy_ticks);
+      sector_cnt += q->sector_cnt;
+    }
+  if (!list_empty (&all_queues))
+    printf ("All queues: %llu sectors in %"PRId64" ticks of uptime\n",
+            sector_cnt, timer_ticks ());
+}
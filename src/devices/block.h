@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +55,43 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+
+struct block_request;
+typedef void block_complete_func (struct block_request *);
+
+/* A request to transfer a run of sectors.  The submitter owns
+   the request and must keep it (and its buffer) alive until
+   COMPLETE has been called. */
+struct block_request
+  {
+    struct list_elem elem;      /* Element in a block_queue. */
+    struct block *block;        /* Device that will carry it out. */
+    bool write;                 /* Write (true) or read (false)? */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes of
+                                   kernel memory. */
+    block_complete_func *complete;      /* Called when done, or null. */
+    void *aux;                  /* For use by COMPLETE. */
+
+    /* Owned by the block layer. */
+    struct block *origin;       /* Device it was first submitted to. */
+    uint64_t start;             /* Time stamp counter at submission. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_complete_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,10 +101,31 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer calls read or write once per
+       sector instead. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional.  Takes over an asynchronous request, for devices
+       such as partitions that pass their requests on to another
+       device.  If null, requests go through the device's queue,
+       or are carried out synchronously if it has none.  The
+       driver calls block_complete() once it has carried out the
+       request. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_complete (struct block_request *);
+
+/* Request queues. */
+struct block_queue *block_queue_create (const char *name);
+void block_set_queue (struct block *, struct block_queue *);
 
 #endif /* devices/block.h */
@@ -5,10 +5,13 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +33,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE registers, relative to a channel's bm_base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Interrupt (write 1 to clear). */
+#define BM_STA_DMA0 0x20        /* Device 0 DMA capable. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +67,32 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors transferred by one command.  A
+   sector count of 0 in reg_nsect means 256. */
+#define MAX_CMD_SECTORS 256
+
+/* PCI class of IDE controllers. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+/* A bus master Physical Region Descriptor, which describes one
+   physically contiguous region of memory for a DMA transfer. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, must be even. */
+    uint16_t size;              /* Size in bytes, 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Number of PRDs in a channel's table, which is one page. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +101,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt with READ/WRITE
+                                   MULTIPLE, or 0 if not in use. */
+    bool dma;                   /* Transfer by bus master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -71,6 +118,11 @@ struct channel
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct block_queue *queue;  /* Requests for this channel's disks. */
+
+    uint16_t bm_base;           /* Bus master registers, 0 if no DMA. */
+    struct prd *prdt;           /* Bus master PRD table. */
+    uint8_t bm_status;          /* Bus master status at last interrupt. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -84,11 +136,15 @@ static struct block_operations ide_operations;
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int max);
+static void init_bus_master (void);
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *, bool read);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -103,6 +159,8 @@ ide_init (void)
 {
   size_t chan_no;
 
+  init_bus_master ();
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -124,6 +182,10 @@ ide_init (void)
           NOT_REACHED ();
         }
       lock_init (&c->lock);
+
+      /* Each channel has its own queue and dispatcher, so that
+         disks on different channels transfer in parallel. */
+      c->queue = block_queue_create (c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
  
@@ -136,6 +198,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -279,7 +343,22 @@ identify_ata_device (struct ata_disk *d)
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
+
+  /* Word 47 gives the most sectors that READ/WRITE MULTIPLE can
+     transfer per interrupt, or 0 if they are not supported. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
+  /* Word 49 bit 8 says whether the disk supports DMA.  If so,
+     and the channel has a bus master, tell the controller that
+     the disk is DMA capable. */
+  if (c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100))
+    {
+      d->dma = true;
+      outb (reg_bm_status (c),
+            (inb (reg_bm_status (c)) & ~(BM_STA_ERR | BM_STA_INTR))
+            | (BM_STA_DMA0 << d->dev_no));
+    }
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -306,9 +385,32 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_set_queue (block, c->queue);
   partition_scan (block);
 }
 
+/* Tries to put disk D into a mode where READ MULTIPLE and WRITE
+   MULTIPLE transfer MAX sectors per interrupt, and records the
+   result in D.  Transfers fall back to one sector per interrupt
+   if the disk does not support that. */
+static void
+set_multiple_mode (struct ata_disk *d, int max)
+{
+  struct channel *c = d->channel;
+
+  d->multiple = 0;
+  if (max < 2)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), max);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_alt_status (c)) & STA_ERR))
+    d->multiple = max;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +439,167 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Returns the number of sectors that disk D transfers per
+   interrupt in PIO mode. */
+static size_t
+sectors_per_interrupt (const struct ata_disk *d)
+{
+  return d->multiple > 0 ? d->multiple : 1;
+}
+
+/* Reads CNT sectors, at most MAX_CMD_SECTORS, starting at SEC_NO
+   from disk D into BUFFER in PIO mode, taking one interrupt per
+   sectors_per_interrupt() sectors.  The caller must hold the
+   channel lock. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  size_t per_intr = sectors_per_interrupt (d);
+  size_t i;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, (d->multiple > 0 ? CMD_READ_MULTIPLE
+                         : CMD_READ_SECTOR_RETRY));
+  for (i = 0; i < cnt; i += per_intr)
+    {
+      size_t n = cnt - i < per_intr ? cnt - i : per_intr;
+
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+      input_sectors (c, buffer, n);
+      buffer += n * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/* Writes CNT sectors, at most MAX_CMD_SECTORS, starting at
+   SEC_NO to disk D from BUFFER in PIO mode.  The caller must
+   hold the channel lock. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  size_t per_intr = sectors_per_interrupt (d);
+  size_t i;
+
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, (d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                         : CMD_WRITE_SECTOR_RETRY));
+  for (i = 0; i < cnt; i += per_intr)
+    {
+      size_t n = cnt - i < per_intr ? cnt - i : per_intr;
+
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
+      output_sectors (c, buffer, n);
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sema_down (&c->completion_wait);
+    }
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Uses
+   DMA if possible, otherwise PIO, in commands of up to
+   MAX_CMD_SECTORS sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t cmd_cnt = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+
+      if (!d->dma || !dma_transfer (d, sec_no, cmd_cnt, p, true))
+        pio_read (d, sec_no, cmd_cnt, p);
+      p += cmd_cnt * BLOCK_SECTOR_SIZE;
+      sec_no += cmd_cnt;
+      cnt -= cmd_cnt;
+    }
   lock_release (&c->lock);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the disk has acknowledged receiving the data.  Uses DMA
+   if possible, otherwise PIO.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t cmd_cnt = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+
+      if (!d->dma || !dma_transfer (d, sec_no, cmd_cnt, (void *) p, false))
+        pio_write (d, sec_no, cmd_cnt, p);
+      p += cmd_cnt * BLOCK_SECTOR_SIZE;
+      sec_no += cmd_cnt;
+      cnt -= cmd_cnt;
+    }
   lock_release (&c->lock);
 }
 
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT, which must be between
+   1 and MAX_CMD_SECTORS, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_CMD_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_CMD_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -414,21 +620,133 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
+{
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
+}
+
+/* Writes CNT sectors to channel C's data register in PIO mode.
+   SECTORS must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
+{
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
+}
+
+/* Bus master DMA.
+
+   The PIIX family's IDE function can transfer data between the
+   disk and memory by itself, given a table of physical memory
+   regions, and interrupts once the whole transfer is done.  See
+   the Intel 82371SB (PIIX3) datasheet, section 2.7. */
+
+/* Fills in channel C's PRD table to describe the SIZE bytes at
+   BUFFER, with one entry per page.  Returns true if successful,
+   false if BUFFER cannot be used for DMA.
+
+   Only kernel memory is used for DMA.  A user page could be
+   unmapped by another thread and its frame reused while the
+   device is still transferring, since nothing pins it. */
+static bool
+build_prdt (struct channel *c, uint8_t *buffer, size_t size)
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  struct prd *prd = c->prdt;
+
+  /* Regions must be in kernel memory and start at even
+     addresses. */
+  if (!is_kernel_vaddr (buffer) || ((uintptr_t) buffer & 1))
+    return false;
+
+  while (size > 0)
+    {
+      size_t chunk = PGSIZE - pg_ofs (buffer);
+
+      if (chunk > size)
+        chunk = size;
+      ASSERT (prd < c->prdt + PRD_CNT);
+
+      prd->addr = vtop (buffer);
+      prd->size = chunk;
+      prd->flags = 0;
+      prd++;
+
+      buffer += chunk;
+      size -= chunk;
+    }
+  prd[-1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT sectors, at most MAX_CMD_SECTORS, starting at
+   SEC_NO between disk D and BUFFER by DMA: into BUFFER if READ
+   is true, otherwise out of it.  The caller must hold the
+   channel lock.  Returns true if successful, false if BUFFER
+   cannot be used for DMA or the transfer failed, in which case
+   the caller should fall back to PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool read)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = read ? BM_CMD_READ : 0;
+
+  if (!build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE))
+    return false;
+
+  select_sectors (d, sec_no, cnt);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_INTR);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+
+  /* The interrupt handler saves the bus master status. */
+  sema_down (&c->completion_wait);
+  outb (reg_bm_command (c), direction);
+
+  if ((c->bm_status & BM_STA_ERR) || (inb (reg_alt_status (c)) & STA_ERR))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", retrying with PIO\n",
+              d->name, read ? "read" : "write", sec_no);
+      return false;
+    }
+  return true;
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Looks for a PCI IDE controller that can act as a bus master
+   and, if one is found, sets up each channel to use it. */
 static void
-output_sector (struct channel *c, const void *sector) 
+init_bus_master (void)
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  struct pci_dev pd;
+  uint32_t base;
+  size_t chan_no;
+
+  /* Programming interface bit 7 means bus mastering is
+     supported. */
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pd)
+      || !(pd.prog_if & 0x80))
+    return;
+
+  /* BAR 4 holds the bus master registers, 8 ports per channel. */
+  base = pci_get_bar (&pd, 4);
+  if (base == 0 || !(pci_read_config (&pd, PCI_REG_BAR0 + 4 * 4) & 1))
+    return;
+  pci_enable (&pd, PCI_CMD_IO | PCI_CMD_MASTER);
+
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      c->prdt = palloc_get_page (0);
+      if (c->prdt != NULL)
+        c->bm_base = base + 8 * chan_no;
+    }
 }
+
 
 /* Low-level ATA primitives. */
 
@@ -513,6 +831,13 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
+            if (c->bm_base != 0)
+              {
+                /* Save bus master status, then clear its interrupt
+                   and error bits by writing them back. */
+                c->bm_status = inb (reg_bm_status (c));
+                outb (reg_bm_status (c), c->bm_status);
+              }
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
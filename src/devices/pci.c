@@ -0,0 +1,165 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* Minimal access to PCI configuration space, using
+   configuration mechanism #1 from the PCI Local Bus
+   Specification, section 3.2.2.3.2.  This is just enough for
+   drivers to locate their device and its resources; there is no
+   support for hot plug or message-signaled interrupts. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Number of buses, devices per bus, and functions per device. */
+#define PCI_BUS_CNT 256
+#define PCI_DEV_CNT 32
+#define PCI_FUNC_CNT 8
+
+/* Returns the value to write to PCI_CONFIG_ADDRESS to access
+   register REG of function FUNC of device DEV on bus BUS. */
+static uint32_t
+config_address (int bus, int dev, int func, uint8_t reg)
+{
+  return (0x80000000u | (bus << 16) | (dev << 11) | (func << 8)
+          | (reg & 0xfc));
+}
+
+/* Reads the 32-bit configuration register at REG, which must be
+   a multiple of 4, of the given function. */
+static uint32_t
+read_config (int bus, int dev, int func, uint8_t reg)
+{
+  outl (PCI_CONFIG_ADDRESS, config_address (bus, dev, func, reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Scans configuration space for a function for which MATCH
+   returns true when passed the function's identification and
+   AUX.  If one is found, stores it in *PD and returns true;
+   otherwise, returns false. */
+static bool
+scan (bool (*match) (const struct pci_dev *, const void *aux),
+      const void *aux, struct pci_dev *pd)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < PCI_BUS_CNT; bus++)
+    for (dev = 0; dev < PCI_DEV_CNT; dev++)
+      for (func = 0; func < PCI_FUNC_CNT; func++)
+        {
+          uint32_t id = read_config (bus, dev, func, 0x00);
+          uint32_t class;
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is missing, so
+                 is the whole device. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class = read_config (bus, dev, func, 0x08);
+          pd->bus = bus;
+          pd->dev = dev;
+          pd->func = func;
+          pd->vendor_id = id & 0xffff;
+          pd->device_id = id >> 16;
+          pd->class = class >> 24;
+          pd->subclass = class >> 16;
+          pd->prog_if = class >> 8;
+          pd->irq_line = read_config (bus, dev, func, 0x3c);
+          if (match (pd, aux))
+            return true;
+
+          /* Only multifunction devices (bit 7 of the header type)
+             have functions other than 0. */
+          if (func == 0 && !(read_config (bus, dev, func, 0x0c) & 0x800000))
+            break;
+        }
+  return false;
+}
+
+/* Returns true if PD has the base class and subclass in the
+   two-byte array CLASS. */
+static bool
+match_class (const struct pci_dev *pd, const void *class_)
+{
+  const uint8_t *class = class_;
+  return pd->class == class[0] && pd->subclass == class[1];
+}
+
+/* Returns true if PD has the vendor and device IDs in the
+   two-element array IDS. */
+static bool
+match_device (const struct pci_dev *pd, const void *ids_)
+{
+  const uint16_t *ids = ids_;
+  return pd->vendor_id == ids[0] && pd->device_id == ids[1];
+}
+
+/* Finds the first PCI function with the given base CLASS and
+   SUBCLASS and stores it in *PD.  Returns true if successful,
+   false if there is no such function. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *pd)
+{
+  uint8_t key[2] = { class, subclass };
+  return scan (match_class, key, pd);
+}
+
+/* Finds the first PCI function with the given VENDOR_ID and
+   DEVICE_ID and stores it in *PD.  Returns true if successful,
+   false if there is no such function. */
+bool
+pci_find_device (uint16_t vendor_id, uint16_t device_id, struct pci_dev *pd)
+{
+  uint16_t key[2] = { vendor_id, device_id };
+  return scan (match_device, key, pd);
+}
+
+/* Reads the 32-bit configuration register at REG, which must be
+   a multiple of 4, of PD. */
+uint32_t
+pci_read_config (const struct pci_dev *pd, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+  return read_config (pd->bus, pd->dev, pd->func, reg);
+}
+
+/* Writes VALUE to the 32-bit configuration register at REG,
+   which must be a multiple of 4, of PD. */
+void
+pci_write_config (const struct pci_dev *pd, uint8_t reg, uint32_t value)
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDRESS, config_address (pd->bus, pd->dev, pd->func, reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns the address in Base Address Register BAR of PD, with
+   the type bits masked off.  For an I/O BAR this is a port
+   number, otherwise a physical memory address. */
+uint32_t
+pci_get_bar (const struct pci_dev *pd, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (pd, PCI_REG_BAR0 + bar * 4);
+  return value & 1 ? value & ~0x3u : value & ~0xfu;
+}
+
+/* Sets COMMAND_BITS (some of the PCI_CMD_* bits) in PD's command
+   register, e.g. to allow it to act as a bus master. */
+void
+pci_enable (const struct pci_dev *pd, uint16_t command_bits)
+{
+  uint32_t cmd = pci_read_config (pd, PCI_REG_COMMAND);
+
+  /* The upper half is the status register, whose bits are
+     cleared by writing 1s, so write zeros there. */
+  pci_write_config (pd, PCI_REG_COMMAND, (cmd & 0xffff) | command_bits);
+}
@@ -0,0 +1,142 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A block device whose contents live in kernel memory, for use
+   as a fast file system, scratch, or swap device.  It starts out
+   zeroed and its contents are lost when Pintos shuts down.
+
+   The memory is a set of individually allocated pages rather
+   than one contiguous region, so that a large RAM disk does not
+   need a large run of free pages. */
+
+/* Number of sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The RAM disk. */
+struct ramdisk
+  {
+    void **pages;               /* Backing pages. */
+    size_t page_cnt;            /* Number of pages. */
+    struct lock lock;           /* Serializes transfers. */
+  };
+
+static struct ramdisk ramdisk;
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk of SIZE_KB kB, rounded up to a whole
+   number of pages, and registers it as block device "ram0".
+   Does nothing if SIZE_KB is 0.  The device has type BLOCK_RAW,
+   so it must be assigned a role by name, e.g. with
+   "-filesys=ram0", and formatted before use as a file
+   system. */
+void
+ramdisk_init (size_t size_kb)
+{
+  struct ramdisk *rd = &ramdisk;
+  size_t i;
+
+  if (size_kb == 0)
+    return;
+
+  rd->page_cnt = DIV_ROUND_UP (size_kb * 1024, PGSIZE);
+  rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("ram0: out of memory");
+  for (i = 0; i < rd->page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("ram0: out of memory after %zu of %zu pages",
+               i, rd->page_cnt);
+    }
+  lock_init (&rd->lock);
+
+  block_register ("ram0", BLOCK_RAW, "RAM disk",
+                  rd->page_cnt * SECTORS_PER_PAGE, &ramdisk_operations, rd);
+}
+
+/* Returns the address of sector SECTOR in RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  uint8_t *page = rd->pages[sector / SECTORS_PER_PAGE];
+  return page + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE;
+}
+
+/* Copies CNT sectors starting at SECTOR between RD_ and
+   BUFFER: into BUFFER if WRITE is false, otherwise out of it.
+   Each page is copied with a single memcpy(). */
+static void
+copy_sectors (void *rd_, block_sector_t sector, size_t cnt, uint8_t *buffer,
+              bool write)
+{
+  struct ramdisk *rd = rd_;
+
+  lock_acquire (&rd->lock);
+  while (cnt > 0)
+    {
+      size_t n = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      size_t size;
+
+      if (n > cnt)
+        n = cnt;
+      size = n * BLOCK_SECTOR_SIZE;
+      if (write)
+        memcpy (sector_addr (rd, sector), buffer, size);
+      else
+        memcpy (buffer, sector_addr (rd, sector), size);
+
+      buffer += size;
+      sector += n;
+      cnt -= n;
+    }
+  lock_release (&rd->lock);
+}
+
+/* Reads CNT sectors starting at SECTOR from RD into BUFFER. */
+static void
+ramdisk_read_multiple (void *rd, block_sector_t sector, size_t cnt,
+                       void *buffer)
+{
+  copy_sectors (rd, sector, cnt, buffer, false);
+}
+
+/* Writes CNT sectors starting at SECTOR to RD from BUFFER. */
+static void
+ramdisk_write_multiple (void *rd, block_sector_t sector, size_t cnt,
+                        const void *buffer)
+{
+  copy_sectors (rd, sector, cnt, (uint8_t *) buffer, true);
+}
+
+/* Reads sector SECTOR from RD into BUFFER. */
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (rd, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to RD from BUFFER. */
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (rd, sector, 1, buffer);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple,
+    NULL
+  };
@@ -0,0 +1,411 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for a virtio block device, as provided by QEMU's
+   "-drive if=virtio", using the legacy PCI interface from the
+   virtio 0.9.5 specification.
+
+   The device has a single "split" virtqueue through which we
+   hand it requests and it hands back completions.  Each request
+   takes a chain of three descriptors: a header that says what
+   to do, the data buffer, and a status byte that the device
+   fills in.  Many requests may be in flight at once; the device
+   interrupts as it completes them. */
+
+/* PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio registers, relative to BAR 0. */
+#define REG_DEVICE_FEATURES 0x00        /* Device features (32 bits). */
+#define REG_GUEST_FEATURES 0x04         /* Driver features (32 bits). */
+#define REG_QUEUE_PFN 0x08              /* Queue page number (32 bits). */
+#define REG_QUEUE_SIZE 0x0c             /* Queue size (16 bits). */
+#define REG_QUEUE_SELECT 0x0e           /* Queue select (16 bits). */
+#define REG_QUEUE_NOTIFY 0x10           /* Queue notify (16 bits). */
+#define REG_DEVICE_STATUS 0x12          /* Device status (8 bits). */
+#define REG_ISR_STATUS 0x13             /* Interrupt status (8 bits). */
+#define REG_CAPACITY 0x14               /* Capacity in sectors (64 bits). */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /* Guest has noticed device. */
+#define STATUS_DRIVER 0x02              /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+
+/* Virtqueue alignment required by the legacy interface. */
+#define VRING_ALIGN PGSIZE
+
+/* A virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Buffer length. */
+    uint16_t flags;             /* VRING_DESC_F_*. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+#define VRING_DESC_F_NEXT 1     /* Chain continues in NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes the buffer. */
+
+/* Ring of descriptor chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where we put the next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+/* An entry in the used ring. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of completed chain. */
+    uint32_t len;               /* Bytes written by device. */
+  };
+
+/* Ring of descriptor chains that the device is done with. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts its next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Request header. */
+struct virtio_blk_outhdr
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t ioprio;            /* Priority, unused. */
+    uint64_t sector;            /* First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+
+/* Value of the status byte on success. */
+#define VIRTIO_BLK_S_OK 0
+
+/* Descriptors per request. */
+#define DESCS_PER_SLOT 3
+
+/* One request's worth of descriptors and the memory that its
+   header and status descriptors point to.  Slot I owns
+   descriptors I * DESCS_PER_SLOT through I * DESCS_PER_SLOT +
+   2, which are always chained together. */
+struct slot
+  {
+    struct virtio_blk_outhdr hdr;       /* Request header. */
+    uint8_t status;                     /* Written by the device. */
+    struct block_request *req;          /* Request in flight. */
+  };
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    char name[8];               /* Block device name, "vda". */
+    uint16_t io_base;           /* Base of legacy registers. */
+    uint16_t queue_size;        /* Number of descriptors. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    uint16_t last_used;         /* Used ring entries consumed so far. */
+
+    /* Slots.  FREE_SLOTS and the free stack are only changed with
+       interrupts off, since the interrupt handler frees slots. */
+    struct slot *slots;         /* Slots. */
+    size_t slot_cnt;            /* Number of slots. */
+    uint16_t *free_stack;       /* Indexes of free slots. */
+    size_t free_cnt;            /* Number of entries in free_stack. */
+    struct semaphore free_slots;        /* Counts free slots. */
+  };
+
+/* We support a single device. */
+static struct virtio_blk vblk;
+
+static struct block_operations virtio_blk_operations;
+static intr_handler_func interrupt_handler;
+
+/* Returns the number of bytes occupied by a legacy virtqueue
+   with QSIZE descriptors. */
+static size_t
+vring_size (uint16_t qsize)
+{
+  return (ROUND_UP (sizeof (struct vring_desc) * qsize
+                    + sizeof (uint16_t) * (3 + qsize), VRING_ALIGN)
+          + ROUND_UP (sizeof (uint16_t) * 3
+                      + sizeof (struct vring_used_elem) * qsize,
+                      VRING_ALIGN));
+}
+
+/* Looks for a virtio block device on the PCI bus and, if one is
+   found, initializes it and registers it as block device
+   "vda". */
+void
+virtio_blk_init (void)
+{
+  struct virtio_blk *vb = &vblk;
+  struct pci_dev pd;
+  uint32_t capacity_lo, capacity_hi;
+  block_sector_t capacity;
+  struct block *block;
+  uint8_t *vring;
+  size_t i;
+
+  if (!pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID, &pd))
+    return;
+  strlcpy (vb->name, "vda", sizeof vb->name);
+  if (pd.irq_line >= 16)
+    {
+      printf ("%s: no interrupt line assigned, ignoring\n", vb->name);
+      return;
+    }
+  vb->io_base = pci_get_bar (&pd, 0);
+  pci_enable (&pd, PCI_CMD_IO | PCI_CMD_MASTER);
+
+  /* Reset the device, then tell it that we know how to drive
+     it.  We do not need any optional features. */
+  outb (vb->io_base + REG_DEVICE_STATUS, 0);
+  outb (vb->io_base + REG_DEVICE_STATUS, STATUS_ACKNOWLEDGE);
+  outb (vb->io_base + REG_DEVICE_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  outl (vb->io_base + REG_GUEST_FEATURES, 0);
+
+  /* Set up queue 0, the only one a block device has.  The rings
+     must be physically contiguous, which pages from the kernel
+     pool always are. */
+  outw (vb->io_base + REG_QUEUE_SELECT, 0);
+  vb->queue_size = inw (vb->io_base + REG_QUEUE_SIZE);
+  if (vb->queue_size < DESCS_PER_SLOT)
+    {
+      printf ("%s: unusable queue size %"PRIu16"\n",
+              vb->name, vb->queue_size);
+      return;
+    }
+  vring = palloc_get_multiple (PAL_ZERO,
+                               vring_size (vb->queue_size) / PGSIZE);
+  vb->slot_cnt = vb->queue_size / DESCS_PER_SLOT;
+  vb->slots = calloc (vb->slot_cnt, sizeof *vb->slots);
+  vb->free_stack = calloc (vb->slot_cnt, sizeof *vb->free_stack);
+  if (vring == NULL || vb->slots == NULL || vb->free_stack == NULL)
+    PANIC ("%s: out of memory", vb->name);
+
+  vb->desc = (struct vring_desc *) vring;
+  vb->avail = (struct vring_avail *) (vb->desc + vb->queue_size);
+  vb->used = (struct vring_used *)
+    (vring + ROUND_UP (sizeof (struct vring_desc) * vb->queue_size
+                       + sizeof (uint16_t) * (3 + vb->queue_size),
+                       VRING_ALIGN));
+  vb->last_used = 0;
+
+  /* Chain each slot's descriptors together once and for all.
+     Only the data descriptor changes from request to request. */
+  for (i = 0; i < vb->slot_cnt; i++)
+    {
+      struct vring_desc *d = &vb->desc[i * DESCS_PER_SLOT];
+      struct slot *s = &vb->slots[i];
+
+      d[0].addr = vtop (&s->hdr);
+      d[0].len = sizeof s->hdr;
+      d[0].flags = VRING_DESC_F_NEXT;
+      d[0].next = i * DESCS_PER_SLOT + 1;
+      d[1].flags = VRING_DESC_F_NEXT;
+      d[1].next = i * DESCS_PER_SLOT + 2;
+      d[2].addr = vtop (&s->status);
+      d[2].len = sizeof s->status;
+      d[2].flags = VRING_DESC_F_WRITE;
+
+      vb->free_stack[i] = i;
+    }
+  vb->free_cnt = vb->slot_cnt;
+  sema_init (&vb->free_slots, vb->slot_cnt);
+
+  outl (vb->io_base + REG_QUEUE_PFN, vtop (vring) / PGSIZE);
+  intr_register_ext (pd.irq_line + 0x20, interrupt_handler, vb->name);
+  outb (vb->io_base + REG_DEVICE_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Register, ignoring any capacity beyond what a block_sector_t
+     can address. */
+  capacity_lo = inl (vb->io_base + REG_CAPACITY);
+  capacity_hi = inl (vb->io_base + REG_CAPACITY + 4);
+  capacity = capacity_hi != 0 ? (block_sector_t) -1 : capacity_lo;
+  block = block_register (vb->name, BLOCK_RAW, "virtio", capacity,
+                          &virtio_blk_operations, vb);
+  partition_scan (block);
+}
+
+/* Hands REQ, whose buffer must be in kernel memory, to device VB
+   and returns without waiting for it to complete.  Waits for a
+   free slot if they are all in use. */
+static void
+start_request (struct virtio_blk *vb, struct block_request *req)
+{
+  struct vring_desc *d;
+  enum intr_level old_level;
+  struct slot *s;
+  size_t idx;
+
+  ASSERT (is_kernel_vaddr (req->buffer));
+  ASSERT (!intr_context ());
+
+  sema_down (&vb->free_slots);
+  old_level = intr_disable ();
+  idx = vb->free_stack[--vb->free_cnt];
+  s = &vb->slots[idx];
+  s->req = req;
+  s->hdr.type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->hdr.ioprio = 0;
+  s->hdr.sector = req->sector;
+  s->status = 0xff;
+
+  /* Kernel virtual memory is physically contiguous, so one
+     descriptor covers the whole buffer. */
+  d = &vb->desc[idx * DESCS_PER_SLOT];
+  d[1].addr = vtop (req->buffer);
+  d[1].len = req->cnt * BLOCK_SECTOR_SIZE;
+  d[1].flags = VRING_DESC_F_NEXT | (req->write ? 0 : VRING_DESC_F_WRITE);
+
+  /* Publish the chain, then the new index, then notify. */
+  vb->avail->ring[vb->avail->idx % vb->queue_size] = idx * DESCS_PER_SLOT;
+  barrier ();
+  vb->avail->idx++;
+  barrier ();
+  outw (vb->io_base + REG_QUEUE_NOTIFY, 0);
+  intr_set_level (old_level);
+}
+
+/* Takes over asynchronous request REQ for device VB_. */
+static void
+virtio_blk_submit (void *vb_, struct block_request *req)
+{
+  start_request (vb_, req);
+}
+
+/* Completion function for requests that the driver waits for
+   itself: wakes up the thread waiting on REQ's aux. */
+static void
+wake_waiter (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Transfers CNT sectors starting at SECTOR between device VB and
+   BUFFER, and waits for the transfer to complete.
+
+   The device needs physical addresses, and only kernel memory is
+   physically contiguous, so a user BUFFER goes through a kernel
+   bounce page. */
+static void
+transfer_wait (struct virtio_blk *vb, bool write, block_sector_t sector,
+               size_t cnt, void *buffer_)
+{
+  size_t sectors_per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+  uint8_t *buffer = buffer_;
+  uint8_t *bounce = NULL;
+
+  if (!is_kernel_vaddr (buffer))
+    {
+      bounce = palloc_get_page (0);
+      if (bounce == NULL)
+        PANIC ("%s: out of memory", vb->name);
+    }
+
+  while (cnt > 0)
+    {
+      size_t n = bounce != NULL && cnt > sectors_per_page
+                 ? sectors_per_page : cnt;
+      void *data = bounce != NULL ? bounce : buffer;
+      struct block_request req;
+      struct semaphore done;
+
+      if (write && bounce != NULL)
+        memcpy (bounce, buffer, n * BLOCK_SECTOR_SIZE);
+      sema_init (&done, 0);
+      block_request_init (&req, write, sector, n, data, wake_waiter, &done);
+      start_request (vb, &req);
+      sema_down (&done);
+      if (!write && bounce != NULL)
+        memcpy (buffer, bounce, n * BLOCK_SECTOR_SIZE);
+
+      buffer += n * BLOCK_SECTOR_SIZE;
+      sector += n;
+      cnt -= n;
+    }
+  palloc_free_page (bounce);
+}
+
+/* Reads CNT sectors starting at SECTOR from VB into BUFFER. */
+static void
+virtio_blk_read_multiple (void *vb, block_sector_t sector, size_t cnt,
+                          void *buffer)
+{
+  transfer_wait (vb, false, sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to VB from BUFFER. */
+static void
+virtio_blk_write_multiple (void *vb, block_sector_t sector, size_t cnt,
+                           const void *buffer)
+{
+  transfer_wait (vb, true, sector, cnt, (void *) buffer);
+}
+
+/* Reads sector SECTOR from VB into BUFFER. */
+static void
+virtio_blk_read (void *vb, block_sector_t sector, void *buffer)
+{
+  transfer_wait (vb, false, sector, 1, buffer);
+}
+
+/* Writes sector SECTOR to VB from BUFFER. */
+static void
+virtio_blk_write (void *vb, block_sector_t sector, const void *buffer)
+{
+  transfer_wait (vb, true, sector, 1, (void *) buffer);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    virtio_blk_read_multiple,
+    virtio_blk_write_multiple,
+    virtio_blk_submit
+  };
+
+/* Virtio interrupt handler.  Completes every request that the
+   device has moved to the used ring. */
+static void
+interrupt_handler (struct intr_frame *f UNUSED)
+{
+  struct virtio_blk *vb = &vblk;
+
+  /* Reading the ISR status acknowledges the interrupt. */
+  inb (vb->io_base + REG_ISR_STATUS);
+
+  while (vb->last_used != vb->used->idx)
+    {
+      uint32_t head = vb->used->ring[vb->last_used % vb->queue_size].id;
+      size_t idx = head / DESCS_PER_SLOT;
+      struct slot *s = &vb->slots[idx];
+      struct block_request *req = s->req;
+
+      if (s->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: %s failed, sector=%"PRDSNu", status=%d", vb->name,
+               req->write ? "write" : "read", req->sector, s->status);
+
+      vb->last_used++;
+      vb->free_stack[vb->free_cnt++] = idx;
+      sema_up (&vb->free_slots);
+      block_complete (req);
+    }
+}
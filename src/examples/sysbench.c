@@ -0,0 +1,107 @@
+/* sysbench.c
+
+   Measures the cost of a trivial system call when entered with
+   `int $0x30', with SYSENTER, and in batches through a syscall
+   ring, in CPU cycles per call.
+
+   The system call used is filesize() on a file descriptor that
+   is not open, which returns right away, so nearly all of the
+   time measured is spent getting into and out of the kernel. */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include <syscall-ring.h>
+
+/* Number of calls to time. */
+#define ITERATIONS 100000
+
+static inline uint64_t
+rdtsc (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Calls filesize(-1) with `int $0x30'. */
+static int
+call_int (void) 
+{
+  int retval;
+  asm volatile
+    ("pushl $-1; pushl %[number]; int $0x30; addl $8, %%esp"
+       : "=a" (retval)
+       : [number] "i" (SYS_FILESIZE)
+       : "memory");
+  return retval;
+}
+
+/* Calls filesize(-1) with SYSENTER. */
+static int
+call_sysenter (void) 
+{
+  int retval;
+  asm volatile
+    ("pushl $-1; pushl %[number]; "
+     "movl %%esp, %%ecx; movl $1f, %%edx; sysenter; 1: "
+     "addl $8, %%esp"
+       : "=a" (retval)
+       : [number] "i" (SYS_FILESIZE)
+       : "memory", "ecx", "edx");
+  return retval;
+}
+
+/* Calls filesize(-1) RING_ENTRIES times with one ring_enter(),
+   and returns the result of the last call. */
+static int
+call_ring (void) 
+{
+  static struct syscall_ring ring;
+  struct ring_cqe cqe = { 0, 0 };
+  int i;
+
+  ring_init (&ring);
+  for (i = 0; i < RING_ENTRIES; i++)
+    ring_push (&ring, SYS_FILESIZE, -1, 0, 0, i);
+  ring_enter (&ring, RING_ENTRIES);
+  while (ring_pop (&ring, &cqe))
+    continue;
+  return cqe.result;
+}
+
+/* Returns the average number of cycles taken by CALL, which
+   makes BATCH system calls. */
+static uint64_t
+time_calls (const char *name, int (*call) (void), int batch) 
+{
+  uint64_t start, cycles;
+  int i;
+
+  for (i = 0; i < ITERATIONS / batch; i++)
+    if (call () != -1)
+      {
+        printf ("%s: unexpected return value\n", name);
+        exit (1);
+      }
+  start = rdtsc ();
+  for (i = 0; i < ITERATIONS / batch; i++)
+    call ();
+  cycles = (rdtsc () - start) / (ITERATIONS / batch * batch);
+
+  printf ("%-8s %6"PRIu64" cycles/call\n", name, cycles);
+  return cycles;
+}
+
+int
+main (void) 
+{
+  uint64_t slow = time_calls ("int", call_int, 1);
+  uint64_t fast = time_calls ("sysenter", call_sysenter, 1);
+
+  if (fast < slow)
+    printf ("sysenter saves %"PRIu64" cycles/call\n", slow - fast);
+  time_calls ("ring", call_ring, RING_ENTRIES);
+  return 0;
+}
@@ -0,0 +1,206 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Maps a (parent directory sector, name) pair to the inode that
+   the name refers to, so that resolving a path that was resolved
+   recently does not have to read any directory buckets.  An
+   entry whose inode is null is a negative entry: it records that
+   the name does not exist.
+
+   Positive entries hold an open reference to their inode, which
+   keeps the inode in the open inode table, so a hit does not
+   have to read the on-disk inode either.  The cache is bounded
+   and evicts the least recently used entry. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_SIZE 128
+
+/* A cached directory entry. */
+struct dcache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem list_elem;         /* Element in lru or free list. */
+    block_sector_t parent;              /* Sector of parent directory. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    struct inode *inode;                /* Inode, or null if no such file. */
+  };
+
+static struct dcache_entry entries[DCACHE_SIZE];
+static struct hash dcache;              /* Entries in use. */
+static struct list lru;                 /* In use, most recent first. */
+static struct list free_entries;        /* Not in use. */
+static struct lock dcache_lock;         /* Guards all of the above. */
+
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+static struct dcache_entry *find (block_sector_t, const char *);
+static struct inode *discard (struct dcache_entry *);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  hash_init (&dcache, dcache_hash, dcache_less, NULL);
+  list_init (&lru);
+  list_init (&free_entries);
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&free_entries, &entries[i].list_elem);
+}
+
+/* Looks up NAME in the directory in sector PARENT.
+   Returns false if the cache knows nothing about NAME.
+   Otherwise, returns true and sets *INODE to a new reference to
+   NAME's inode, which the caller must close, or to a null
+   pointer if NAME is known not to exist. */
+bool
+dcache_lookup (block_sector_t parent, const char *name,
+               struct inode **inode)
+{
+  struct dcache_entry *e;
+
+  lock_acquire (&dcache_lock);
+  e = find (parent, name);
+  if (e != NULL)
+    {
+      list_remove (&e->list_elem);
+      list_push_front (&lru, &e->list_elem);
+      *inode = inode_reopen (e->inode);
+    }
+  lock_release (&dcache_lock);
+
+  return e != NULL;
+}
+
+/* Records that NAME in the directory in sector PARENT refers to
+   INODE, or that it does not exist if INODE is null.  The cache
+   takes its own reference to INODE. */
+void
+dcache_insert (block_sector_t parent, const char *name, struct inode *inode)
+{
+  struct dcache_entry *e;
+  struct inode *victim = NULL;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  e = find (parent, name);
+  if (e != NULL)
+    victim = discard (e);
+  else if (list_empty (&free_entries))
+    victim = discard (list_entry (list_back (&lru),
+                                  struct dcache_entry, list_elem));
+
+  e = list_entry (list_pop_front (&free_entries),
+                  struct dcache_entry, list_elem);
+  e->parent = parent;
+  strlcpy (e->name, name, sizeof e->name);
+  e->inode = inode_reopen (inode);
+  hash_insert (&dcache, &e->hash_elem);
+  list_push_front (&lru, &e->list_elem);
+  lock_release (&dcache_lock);
+
+  inode_close (victim);
+}
+
+/* Forgets anything cached about NAME in the directory in sector
+   PARENT. */
+void
+dcache_invalidate (block_sector_t parent, const char *name)
+{
+  struct dcache_entry *e;
+  struct inode *victim = NULL;
+
+  lock_acquire (&dcache_lock);
+  e = find (parent, name);
+  if (e != NULL)
+    victim = discard (e);
+  lock_release (&dcache_lock);
+
+  inode_close (victim);
+}
+
+/* Forgets every entry cached for the directory in sector PARENT,
+   which is being removed.  A removed directory is empty, so this
+   only ever finds negative entries and "..", and closing the
+   parent that ".." pins never frees any blocks, so it is safe to
+   do under dcache_lock. */
+void
+dcache_purge (block_sector_t parent)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dcache_entry *de = list_entry (e, struct dcache_entry,
+                                            list_elem);
+      next = list_next (e);
+      if (de->parent == parent)
+        inode_close (discard (de));
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer if
+   there is none.  The caller must hold dcache_lock. */
+static struct dcache_entry *
+find (block_sector_t parent, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Moves E to the free list and returns the inode reference that
+   it held, which the caller must close once it has released
+   dcache_lock.  The caller must hold dcache_lock. */
+static struct inode *
+discard (struct dcache_entry *e)
+{
+  struct inode *inode = e->inode;
+
+  hash_delete (&dcache, &e->hash_elem);
+  list_remove (&e->list_elem);
+  list_push_back (&free_entries, &e->list_elem);
+  e->inode = NULL;
+  return inode;
+}
+
+/* Returns a hash value for dcache_entry E. */
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dcache_entry *de = hash_entry (e, struct dcache_entry,
+                                              hash_elem);
+  return hash_string (de->name) ^ hash_int (de->parent);
+}
+
+/* Returns true if dcache_entry A precedes dcache_entry B. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                             hash_elem);
+  const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                             hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
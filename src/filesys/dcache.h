@@ -0,0 +1,16 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+struct inode;
+
+void dcache_init (void);
+bool dcache_lookup (block_sector_t parent, const char *name,
+                    struct inode **);
+void dcache_insert (block_sector_t parent, const char *name, struct inode *);
+void dcache_invalidate (block_sector_t parent, const char *name);
+void dcache_purge (block_sector_t parent);
+
+#endif /* filesys/dcache.h */
@@ -1,41 +1,119 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
-#include <list.h>
+#include <hash.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /* A directory. */
-struct dir 
+struct dir
   {
     struct inode *inode;                /* Backing store. */
-    off_t pos;                          /* Current position. */
+    off_t pos;                          /* Index of next entry to read. */
   };
 
 /* A single directory entry. */
-struct dir_entry 
+struct dir_entry
   {
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* Number of entries that fit in a bucket. */
+#define BUCKET_ENTRY_CNT \
+        ((BLOCK_SECTOR_SIZE - 5 * sizeof (uint32_t)) / sizeof (struct dir_entry))
+
+/* On-disk directory bucket, exactly one sector long.
+
+   A directory is a hash table of chained buckets, grown by
+   linear hashing.  A name hashes to one of the directory's
+   primary buckets; when that bucket is full, its entries
+   continue in a chain of overflow buckets.  A lookup therefore
+   usually reads a single bucket no matter how large the
+   directory is.
+
+   Whenever an insertion has to add an overflow bucket, the
+   directory also gains a primary bucket, by splitting the
+   primary buckets one at a time, in order: the entries of the
+   next bucket's chain are divided between it and the new
+   bucket.  Each split rewrites a single chain, so it fits in the
+   journal operation of the insertion that caused it, however
+   large the directory has become.  A chain too long for the log
+   to take at the moment, because many names collide, is left
+   for a later insertion to split.
+
+   Primary bucket I is stored at bucket index 2 * I and overflow
+   bucket J at index 2 * J + 1, so that new primary buckets never
+   land on overflow buckets already in use.  Bucket 0, which is
+   always primary, also holds the directory's header fields. */
+struct dir_bucket
+  {
+    struct dir_entry entries[BUCKET_ENTRY_CNT]; /* Entries. */
+    uint32_t next;              /* Next bucket in chain, 0 if none. */
+
+    /* Bucket 0 only. */
+    block_sector_t parent;      /* Parent directory. */
+    uint32_t primary_cnt;       /* Number of primary buckets. */
+    uint32_t overflow_cnt;      /* Number of overflow buckets made. */
+    uint32_t free_overflow;     /* First unused overflow bucket, or 0. */
+
+    uint8_t unused[BLOCK_SECTOR_SIZE - BUCKET_ENTRY_CNT
+                   * sizeof (struct dir_entry) - 5 * sizeof (uint32_t)];
+  };
+
+static bool is_dot_name (const char *);
+static bool write_bucket (struct inode *, size_t idx,
+                          const struct dir_bucket *);
+
+/* Creates a directory with space for ENTRY_CNT entries, before
+   it first has to grow, in the given SECTOR, whose parent
+   directory is in sector PARENT.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  size_t primary_cnt = DIV_ROUND_UP (entry_cnt, BUCKET_ENTRY_CNT);
+  struct dir_bucket *b;
+  struct inode *inode;
+  bool success = false;
+
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  if (primary_cnt == 0)
+    primary_cnt = 1;
+  if (!inode_create (sector, (2 * primary_cnt - 1) * BLOCK_SECTOR_SIZE,
+                     true))
+    return false;
+
+  /* Fill in the header fields in bucket 0, including the parent
+     for "..".  The other buckets start out as holes, which read
+     back as empty. */
+  b = calloc (1, sizeof *b);
+  inode = inode_open (sector);
+  if (b != NULL && inode != NULL)
+    {
+      b->parent = parent;
+      b->primary_cnt = primary_cnt;
+      success = write_bucket (inode, 0, b);
+    }
+  inode_close (inode);
+  free (b);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
-   it takes ownership.  Returns a null pointer on failure. */
+   it takes ownership.  Returns a null pointer on failure, or if
+   INODE is not a directory. */
 struct dir *
-dir_open (struct inode *inode) 
+dir_open (struct inode *inode)
 {
   struct dir *dir = calloc (1, sizeof *dir);
-  if (inode != NULL && dir != NULL)
+  if (inode != NULL && dir != NULL && inode_is_dir (inode))
     {
       dir->inode = inode;
       dir->pos = 0;
@@ -45,7 +123,7 @@ dir_open (struct inode *inode)
     {
       inode_close (inode);
       free (dir);
-      return NULL; 
+      return NULL;
     }
 }
 
@@ -60,14 +138,14 @@ dir_open_root (void)
 /* Opens and returns a new directory for the same inode as DIR.
    Returns a null pointer on failure. */
 struct dir *
-dir_reopen (struct dir *dir) 
+dir_reopen (struct dir *dir)
 {
   return dir_open (inode_reopen (dir->inode));
 }
 
 /* Destroys DIR and frees associated resources. */
 void
-dir_close (struct dir *dir) 
+dir_close (struct dir *dir)
 {
   if (dir != NULL)
     {
@@ -78,159 +156,609 @@ dir_close (struct dir *dir)
 
 /* Returns the inode encapsulated by DIR. */
 struct inode *
-dir_get_inode (struct dir *dir) 
+dir_get_inode (struct dir *dir)
 {
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/* Returns the number of buckets, primary, overflow, or unused,
+   in the directory backed by INODE. */
+static size_t
+bucket_cnt (struct inode *inode)
+{
+  return inode_length (inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the number of primary buckets in the directory backed
+   by INODE, or 0 on failure. */
+static size_t
+primary_bucket_cnt (struct inode *inode)
+{
+  uint32_t cnt;
+
+  if (inode_read_at (inode, &cnt, sizeof cnt,
+                     offsetof (struct dir_bucket, primary_cnt))
+      != sizeof cnt)
+    return 0;
+  return cnt;
+}
+
+/* Returns the bucket index of primary bucket I. */
+static inline size_t
+primary_bucket (size_t i)
+{
+  return 2 * i;
+}
+
+/* Returns the bucket index of overflow bucket J. */
+static inline size_t
+overflow_bucket (size_t j)
+{
+  return 2 * j + 1;
+}
+
+/* Returns the largest power of 2 less than or equal to
+   PRIMARY_CNT, which must be nonzero.  Primary buckets from this
+   one on are those split off since the number of primary buckets
+   last doubled. */
+static size_t
+split_level (size_t primary_cnt)
+{
+  size_t level = 1;
+
+  ASSERT (primary_cnt > 0);
+  while (level * 2 <= primary_cnt)
+    level *= 2;
+  return level;
+}
+
+/* Returns the primary bucket, out of PRIMARY_CNT, that NAME
+   belongs in.  A name that would belong in a primary bucket that
+   has not been split off yet belongs in the bucket that will be
+   split to make it. */
+static size_t
+home_bucket (const char *name, size_t primary_cnt)
+{
+  unsigned hash = hash_string (name);
+  size_t level = split_level (primary_cnt);
+  size_t i = hash % (2 * level);
+
+  return i < primary_cnt ? i : hash % level;
+}
+
+/* Reads bucket IDX of the directory backed by INODE into B.
+   Returns true if successful, false on failure. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+read_bucket (struct inode *inode, size_t idx, struct dir_bucket *b)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  return (inode_read_at (inode, b, sizeof *b, idx * sizeof *b)
+          == sizeof *b);
+}
+
+/* Writes B to bucket IDX of the directory backed by INODE.
+   Returns true if successful, false on failure. */
+static bool
+write_bucket (struct inode *inode, size_t idx, const struct dir_bucket *b)
+{
+  return (inode_write_at (inode, b, sizeof *b, idx * sizeof *b)
+          == sizeof *b);
+}
+
+/* Searches DIR for a file with the given NAME, using B as
+   scratch space for buckets.
+   If successful, returns true, leaves the bucket that holds the
+   entry in B, and sets *IDXP and *SLOTP to its bucket index and
+   slot within the bucket if they are non-null.
+   Otherwise, returns false and ignores IDXP and SLOTP. */
+static bool
+lookup (const struct dir *dir, const char *name, struct dir_bucket *b,
+        size_t *idxp, size_t *slotp)
+{
+  size_t cnt, idx;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  cnt = primary_bucket_cnt (dir->inode);
+  if (cnt == 0)
+    return false;
+
+  idx = primary_bucket (home_bucket (name, cnt));
+  do
+    {
+      size_t slot;
+
+      if (!read_bucket (dir->inode, idx, b))
+        return false;
+      for (slot = 0; slot < BUCKET_ENTRY_CNT; slot++)
+        {
+          struct dir_entry *e = &b->entries[slot];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (idxp != NULL)
+                *idxp = idx;
+              if (slotp != NULL)
+                *slotp = slot;
+              return true;
+            }
+        }
+      idx = b->next;
+    }
+  while (idx != 0);
   return false;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   "." and ".." name DIR itself and its parent. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
-            struct inode **inode) 
+            struct inode **inode)
 {
-  struct dir_entry e;
+  block_sector_t sector;
+  struct dir_bucket *b;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  *inode = NULL;
+  if (!strcmp (name, "."))
+    {
+      *inode = inode_reopen (dir->inode);
+      return true;
+    }
+
+  sector = inode_get_inumber (dir->inode);
+  if (dcache_lookup (sector, name, inode))
+    return *inode != NULL;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  /* Hold DIR's lock so that a concurrent dir_add() or
+     dir_remove() cannot invalidate NAME between our reading the
+     buckets and caching the result. */
+  inode_lock (dir->inode);
+  if (!strcmp (name, ".."))
+    {
+      if (read_bucket (dir->inode, 0, b))
+        *inode = inode_open (b->parent);
+    }
   else
-    *inode = NULL;
+    {
+      size_t idx, slot;
+      if (lookup (dir, name, b, &idx, &slot))
+        *inode = inode_open (b->entries[slot].inode_sector);
+    }
+  if (!inode_is_removed (dir->inode))
+    dcache_insert (sector, name, *inode);
+  inode_unlock (dir->inode);
+  free (b);
 
   return *inode != NULL;
 }
 
+/* Adds an overflow bucket holding only E to the end of a chain
+   in the directory backed by INODE, whose bucket 0 is HDR.  TAIL
+   is the chain's last bucket, at bucket index TAIL_IDX.
+   Returns true if successful, false on failure. */
+static bool
+add_overflow (struct inode *inode, struct dir_bucket *hdr,
+              struct dir_bucket *tail, size_t tail_idx,
+              const struct dir_entry *e)
+{
+  struct dir_bucket *b;
+  size_t idx;
+  bool success = false;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  /* Reuse an overflow bucket freed by a split, if there is one. */
+  if (hdr->free_overflow != 0)
+    {
+      idx = hdr->free_overflow;
+      if (!read_bucket (inode, idx, b))
+        goto done;
+      hdr->free_overflow = b->next;
+    }
+  else
+    idx = overflow_bucket (hdr->overflow_cnt++);
+
+  memset (b, 0, sizeof *b);
+  b->entries[0] = *e;
+  if (!write_bucket (inode, idx, b))
+    goto done;
+
+  tail->next = idx;
+  success = (write_bucket (inode, tail_idx, tail)
+             && (tail == hdr || write_bucket (inode, 0, hdr)));
+
+ done:
+  free (b);
+  return success;
+}
+
+/* Clears B's entries, fills the first of them with up to a
+   bucketful of the CNT entries in ENTS, and links B to bucket
+   index NEXT. */
+static void
+fill_bucket (struct dir_bucket *b, const struct dir_entry *ents,
+             size_t cnt, size_t next)
+{
+  if (cnt > BUCKET_ENTRY_CNT)
+    cnt = BUCKET_ENTRY_CNT;
+  memset (b->entries, 0, sizeof b->entries);
+  memcpy (b->entries, ents, cnt * sizeof *ents);
+  b->next = next;
+}
+
+/* Most sectors other than buckets that a split changes: the
+   directory's inode, the index blocks it takes to extend the
+   directory by the new primary bucket, and the free map
+   sectors that record their allocation. */
+#define SPLIT_EXTRA_SECTORS 8
+
+/* Returns the number of buckets needed to hold a chain of CNT
+   entries. */
+static size_t
+chain_length (size_t cnt)
+{
+  return cnt > 0 ? DIV_ROUND_UP (cnt, BUCKET_ENTRY_CNT) : 1;
+}
+
+/* Adds a primary bucket to the directory backed by INODE, whose
+   bucket 0 is HDR, by splitting the next primary bucket in turn:
+   the entries in that bucket's chain that now hash to the new
+   bucket move to a chain of their own.  Overflow buckets that
+   either chain no longer needs are put on the free list.
+   Returns true if successful, false on failure, including when
+   the journal operation has no room for the split, in which
+   case nothing is changed. */
+static bool
+split_bucket (struct inode *inode, struct dir_bucket *hdr)
+{
+  size_t old_cnt = hdr->primary_cnt;
+  size_t src = old_cnt - split_level (old_cnt);
+  size_t *chain = NULL;
+  struct dir_entry *ents = NULL;
+  struct dir_bucket *b;
+  size_t chain_cnt, ent_cnt, keep_cnt, move_cnt, keep_len, move_len;
+  size_t idx, i;
+  bool success = false;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  /* Find the length of SRC's chain, then gather its buckets'
+     indexes and entries. */
+  chain_cnt = 0;
+  idx = primary_bucket (src);
+  do
+    {
+      if (!read_bucket (inode, idx, b))
+        goto done;
+      chain_cnt++;
+      idx = b->next;
+    }
+  while (idx != 0);
+
+  /* The split writes every bucket in the chain, the new primary
+     bucket, and bucket 0. */
+  if (!journal_reserve (chain_cnt + 2 + SPLIT_EXTRA_SECTORS))
+    goto done;
+
+  chain = malloc (chain_cnt * sizeof *chain);
+  ents = malloc (chain_cnt * BUCKET_ENTRY_CNT * sizeof *ents);
+  if (chain == NULL || ents == NULL)
+    goto done;
+
+  ent_cnt = 0;
+  idx = primary_bucket (src);
+  for (i = 0; i < chain_cnt; i++)
+    {
+      size_t slot;
+
+      if (!read_bucket (inode, idx, b))
+        goto done;
+      chain[i] = idx;
+      for (slot = 0; slot < BUCKET_ENTRY_CNT; slot++)
+        if (b->entries[slot].in_use)
+          ents[ent_cnt++] = b->entries[slot];
+      idx = b->next;
+    }
+
+  /* Partition the entries into those that stay, first, and those
+     that move to the new bucket. */
+  keep_cnt = 0;
+  for (i = ent_cnt; keep_cnt < i; )
+    if (home_bucket (ents[keep_cnt].name, old_cnt + 1) == src)
+      keep_cnt++;
+    else
+      {
+        struct dir_entry tmp = ents[keep_cnt];
+        ents[keep_cnt] = ents[--i];
+        ents[i] = tmp;
+      }
+  move_cnt = ent_cnt - keep_cnt;
+
+  /* The two chains never need more buckets than the old chain
+     plus the new primary bucket, so the moved entries' overflow
+     buckets come from the end of the old chain. */
+  keep_len = chain_length (keep_cnt);
+  move_len = chain_length (move_cnt);
+  ASSERT (keep_len + move_len - 1 <= chain_cnt);
+
+  /* Write the new chain.  Its primary bucket goes first: it is
+     the only bucket that can extend the directory, and so the
+     only write that can fail for lack of disk space, and nothing
+     else has been changed yet. */
+  for (i = 0; i < move_len; i++)
+    {
+      size_t next = i + 1 < move_len ? chain[keep_len + i] : 0;
+      idx = i == 0 ? primary_bucket (old_cnt) : chain[keep_len + i - 1];
+      memset (b, 0, sizeof *b);
+      fill_bucket (b, ents + keep_cnt + i * BUCKET_ENTRY_CNT,
+                   move_cnt - i * BUCKET_ENTRY_CNT, next);
+      if (!write_bucket (inode, idx, b))
+        goto done;
+    }
+
+  /* Rewrite the old chain, keeping bucket 0's header fields if it
+     is bucket 0's chain. */
+  for (i = 0; i < keep_len; i++)
+    {
+      size_t next = i + 1 < keep_len ? chain[i + 1] : 0;
+      struct dir_bucket *cur = chain[i] == 0 ? hdr : b;
+      if (cur != hdr)
+        memset (cur, 0, sizeof *cur);
+      fill_bucket (cur, ents + i * BUCKET_ENTRY_CNT,
+                   keep_cnt - i * BUCKET_ENTRY_CNT, next);
+      if (cur != hdr && !write_bucket (inode, chain[i], cur))
+        goto done;
+    }
+
+  /* Free the buckets left over. */
+  for (i = keep_len + move_len - 1; i < chain_cnt; i++)
+    {
+      memset (b, 0, sizeof *b);
+      b->next = hdr->free_overflow;
+      if (!write_bucket (inode, chain[i], b))
+        goto done;
+      hdr->free_overflow = chain[i];
+    }
+
+  hdr->primary_cnt = old_cnt + 1;
+  success = write_bucket (inode, 0, hdr);
+
+ done:
+  free (chain);
+  free (ents);
+  free (b);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_bucket *hdr, *b;
   struct dir_entry e;
-  off_t ofs;
+  size_t idx;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX || is_dot_name (name))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  hdr = malloc (sizeof *hdr);
+  b = malloc (sizeof *b);
+  if (hdr == NULL || b == NULL)
+    {
+      free (hdr);
+      free (b);
+      return false;
+    }
+
+  inode_lock (dir->inode);
+
+  /* Check that DIR is still linked in and that NAME is not in
+     use. */
+  if (inode_is_removed (dir->inode) || lookup (dir, name, b, NULL, NULL)
+      || !read_bucket (dir->inode, 0, hdr) || hdr->primary_cnt == 0)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
+  memset (&e, 0, sizeof e);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  strlcpy (e.name, name, sizeof e.name);
+  e.in_use = true;
+
+  /* Put the entry in the first free slot in the chain of NAME's
+     home bucket.  If the chain is full, add an overflow bucket to
+     it, and split a bucket to grow the directory; the entry is
+     in place whether or not the split succeeds. */
+  idx = primary_bucket (home_bucket (name, hdr->primary_cnt));
+  for (;;)
+    {
+      struct dir_bucket *cur = idx == 0 ? hdr : b;
+      size_t slot;
+
+      if (cur != hdr && !read_bucket (dir->inode, idx, cur))
+        break;
+      for (slot = 0; slot < BUCKET_ENTRY_CNT; slot++)
+        if (!cur->entries[slot].in_use)
+          break;
+
+      if (slot < BUCKET_ENTRY_CNT)
+        {
+          cur->entries[slot] = e;
+          success = write_bucket (dir->inode, idx, cur);
+          break;
+        }
+      if (cur->next == 0)
+        {
+          success = add_overflow (dir->inode, hdr, cur, idx, &e);
+          if (success)
+            split_bucket (dir->inode, hdr);
+          break;
+        }
+      idx = cur->next;
+    }
+  if (success)
+    dcache_invalidate (inode_get_inumber (dir->inode), name);
 
  done:
+  inode_unlock (dir->inode);
+  free (hdr);
+  free (b);
   return success;
 }
 
+/* Returns true if the directory backed by INODE has no entries.
+   The caller must hold INODE's lock. */
+static bool
+is_empty (struct inode *inode, struct dir_bucket *b)
+{
+  size_t cnt = bucket_cnt (inode);
+  size_t idx, slot;
+
+  for (idx = 0; idx < cnt; idx++)
+    {
+      if (!read_bucket (inode, idx, b))
+        return false;
+      for (slot = 0; slot < BUCKET_ENTRY_CNT; slot++)
+        if (b->entries[slot].in_use)
+          return false;
+    }
+  return true;
+}
+
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   which occurs only if there is no file with the given NAME, or
+   if NAME is a directory that is not empty. */
 bool
-dir_remove (struct dir *dir, const char *name) 
+dir_remove (struct dir *dir, const char *name)
 {
-  struct dir_entry e;
+  struct dir_bucket *b;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
+  bool is_dir = false;
+  size_t idx, slot;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
+
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, b, &idx, &slot))
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (b->entries[slot].inode_sector);
   if (inode == NULL)
     goto done;
 
+  /* A directory may only be removed once it is empty.  Hold its
+     lock until it is marked removed, so that nothing can be added
+     to it in between. */
+  is_dir = inode_is_dir (inode);
+  if (is_dir)
+    {
+      struct dir_bucket *child = malloc (sizeof *child);
+      bool empty;
+
+      if (child == NULL)
+        {
+          is_dir = false;
+          goto done;
+        }
+      inode_lock (inode);
+      empty = is_empty (inode, child);
+      free (child);
+      if (!empty)
+        goto done;
+    }
+
   /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  b->entries[slot].in_use = false;
+  if (!write_bucket (dir->inode, idx, b))
     goto done;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
 
-  /* Remove inode. */
+  /* Remove inode.  A removed directory's sector may be reused, so
+     drop whatever was cached about its entries. */
   inode_remove (inode);
+  if (is_dir)
+    dcache_purge (inode_get_inumber (inode));
   success = true;
 
  done:
+  if (is_dir)
+    inode_unlock (inode);
+  inode_unlock (dir->inode);
   inode_close (inode);
+  free (b);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  "." and ".." are never returned. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_bucket *b;
+  size_t cnt = bucket_cnt (dir->inode);
+  bool success = false;
+
+  b = malloc (sizeof *b);
+  if (b == NULL)
+    return false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (!success && (size_t) dir->pos / BUCKET_ENTRY_CNT < cnt)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      size_t slot;
+
+      if (!read_bucket (dir->inode, dir->pos / BUCKET_ENTRY_CNT, b))
+        break;
+      for (slot = dir->pos % BUCKET_ENTRY_CNT; slot < BUCKET_ENTRY_CNT;
+           slot++)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        } 
+          dir->pos++;
+          if (b->entries[slot].in_use)
+            {
+              strlcpy (name, b->entries[slot].name, NAME_MAX + 1);
+              success = true;
+              break;
+            }
+        }
     }
-  return false;
+  free (b);
+  return success;
+}
+
+/* Returns true if NAME is "." or "..". */
+static bool
+is_dot_name (const char *name)
+{
+  return !strcmp (name, ".") || !strcmp (name, "..");
 }
@@ -11,10 +11,15 @@
    retained, but much longer full path names must be allowed. */
 #define NAME_MAX 14
 
+/* Number of entries that a new directory has room for before it
+   first has to grow. */
+#define DIR_ENTRY_CNT 128
+
 struct inode;
 
 /* Opening and closing directories. */
-bool dir_create (block_sector_t sector, size_t entry_cnt);
+bool dir_create (block_sector_t sector, size_t entry_cnt,
+                 block_sector_t parent);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_root (void);
 struct dir *dir_reopen (struct dir *);
@@ -2,6 +2,11 @@
 #include <debug.h>
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Size of the kernel buffer used by file_copy_range(), in pages. */
+#define COPY_PAGES 4
 
 /* An open file. */
 struct file 
@@ -84,12 +89,25 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
   return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Reads from FILE into the IOVCNT buffers in IOV, in order,
+   starting at the file's current position.
+   Returns the number of bytes actually read,
+   which may be less than the total size of the buffers if end
+   of file is reached.
+   Advances FILE's position by the number of bytes read. */
+off_t
+file_readv (struct file *file, const struct iovec *iov, int iovcnt) 
+{
+  off_t bytes_read = inode_readv_at (file->inode, iov, iovcnt, file->pos);
+  file->pos += bytes_read;
+  return bytes_read;
+}
+
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the file reaches its maximum
+   size.  Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +120,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the file reaches its maximum
+   size.  Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -113,6 +130,74 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes the IOVCNT buffers in IOV into FILE, in order,
+   starting at the file's current position.
+   Returns the number of bytes actually written,
+   which may be less than the total size of the buffers if the
+   file reaches its maximum size.  Writing past end of file
+   extends the file.
+   Advances FILE's position by the number of bytes written. */
+off_t
+file_writev (struct file *file, const struct iovec *iov, int iovcnt) 
+{
+  off_t bytes_written = inode_writev_at (file->inode, iov, iovcnt,
+                                         file->pos);
+  file->pos += bytes_written;
+  return bytes_written;
+}
+
+/* Copies up to SIZE bytes from IN, starting at its current
+   position, to OUT, starting at its current position, through a
+   kernel buffer.  Returns the number of bytes actually copied,
+   which may be less than SIZE if end of IN is reached or OUT
+   reaches its maximum size.
+   Advances both files' positions by the number of bytes copied.
+   Returns -1 without copying anything if IN and OUT are the same
+   inode and the SIZE bytes to read overlap the SIZE bytes to
+   write, because the copy would then read back its own output. */
+off_t
+file_copy_range (struct file *in, struct file *out, off_t size) 
+{
+  size_t page_cnt = COPY_PAGES;
+  uint8_t *buffer;
+  off_t bytes_copied = 0;
+
+  if (in->inode == out->inode
+      && in->pos - out->pos < size && out->pos - in->pos < size)
+    return -1;
+
+  buffer = palloc_get_multiple (0, page_cnt);
+  if (buffer == NULL) 
+    {
+      page_cnt = 1;
+      buffer = palloc_get_page (0);
+      if (buffer == NULL)
+        return 0;
+    }
+
+  while (bytes_copied < size) 
+    {
+      off_t chunk_size = size - bytes_copied;
+      off_t bytes_read, bytes_written;
+
+      if (chunk_size > (off_t) (page_cnt * PGSIZE))
+        chunk_size = page_cnt * PGSIZE;
+      bytes_read = inode_read_at (in->inode, buffer, chunk_size, in->pos);
+      if (bytes_read == 0)
+        break;
+      bytes_written = inode_write_at (out->inode, buffer, bytes_read,
+                                      out->pos);
+      in->pos += bytes_written;
+      out->pos += bytes_written;
+      bytes_copied += bytes_written;
+      if (bytes_written < bytes_read)
+        break;
+    }
+  palloc_free_multiple (buffer, page_cnt);
+
+  return bytes_copied;
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -2,15 +2,20 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
 static void do_format (void);
+static struct dir *open_parent (const char *path, char name[NAME_MAX + 1]);
+static void discard_inode (block_sector_t);
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -22,11 +27,13 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
+  journal_init (format);
   free_map_open ();
 }
 
@@ -36,6 +43,7 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+  journal_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -45,20 +53,61 @@ filesys_done (void)
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
+  char file_name[NAME_MAX + 1];
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
+  bool created = false;
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = open_parent (name, file_name);
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && (created = inode_create (inode_sector, initial_size, false))
+             && dir_add (dir, file_name, inode_sector));
+  if (!success && created)
+    discard_inode (inode_sector);
+  else if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file or directory named NAME already exists, if
+   a directory along the way does not exist, or if internal
+   memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  char dir_name[NAME_MAX + 1];
+  block_sector_t inode_sector = 0;
+  bool created = false;
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = open_parent (name, dir_name);
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && (created = dir_create (inode_sector, DIR_ENTRY_CNT,
+                                       inode_get_inumber
+                                         (dir_get_inode (dir))))
+             && dir_add (dir, dir_name, inode_sector));
+  if (!success && created)
+    discard_inode (inode_sector);
+  else if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,29 +115,74 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char file_name[NAME_MAX + 1];
+  struct dir *dir = open_parent (name, file_name);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, file_name, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Opens the directory with the given NAME.
+   Returns the new directory if successful or a null pointer
+   otherwise.
+   Fails if NAME does not exist or is not a directory. */
+struct dir *
+filesys_open_dir (const char *name)
+{
+  char dir_name[NAME_MAX + 1];
+  struct dir *dir = open_parent (name, dir_name);
+  struct inode *inode = NULL;
+
+  if (dir != NULL)
+    dir_lookup (dir, dir_name, &inode);
+  dir_close (dir);
+
+  return dir_open (inode);
+}
+
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
    Fails if no file named NAME exists,
    or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char file_name[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  journal_begin ();
+  dir = open_parent (name, file_name);
+  success = dir != NULL && dir_remove (dir, file_name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
+
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name)
+{
+#ifdef USERPROG
+  struct dir *dir = filesys_open_dir (name);
+  struct thread *t = thread_current ();
+
+  if (dir == NULL)
+    return false;
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+#else
+  return false;
+#endif
+}
+
 
 /* Formats the file system. */
 static void
@@ -96,8 +190,114 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, DIR_ENTRY_CNT, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
 }
+
+
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Opens the directory in which PATH starts: the root directory
+   for an absolute path, otherwise the current thread's working
+   directory. */
+static struct dir *
+open_start_dir (const char *path)
+{
+#ifdef USERPROG
+  struct dir *cwd = thread_current ()->cwd;
+  if (*path != '/' && cwd != NULL)
+    return dir_reopen (cwd);
+#endif
+  return dir_open_root ();
+}
+
+/* Opens the directory that contains the last component of PATH
+   and copies that component into NAME.  If PATH has no
+   components, e.g. "/", NAME is set to ".".
+   Returns a null pointer if PATH is empty, if a component is
+   too long, or if a directory along the way does not exist.
+   The caller must close the returned directory. */
+static struct dir *
+open_parent (const char *path, char name[NAME_MAX + 1])
+{
+  struct dir *dir;
+  char part[NAME_MAX + 1];
+  int result;
+
+  if (*path == '\0')
+    return NULL;
+
+  dir = open_start_dir (path);
+  strlcpy (name, ".", NAME_MAX + 1);
+  result = get_next_part (name, &path);
+  while (dir != NULL && result > 0)
+    {
+      struct inode *inode;
+
+      result = get_next_part (part, &path);
+      if (result <= 0)
+        break;
+
+      /* NAME is not the last component, so step into it. */
+      dir_lookup (dir, name, &inode);
+      dir_close (dir);
+      dir = dir_open (inode);
+      strlcpy (name, part, NAME_MAX + 1);
+    }
+
+  if (result < 0)
+    {
+      dir_close (dir);
+      return NULL;
+    }
+  return dir;
+}
+
+/* Releases the inode in SECTOR, which was created but never
+   linked into a directory, along with its data blocks. */
+static void
+discard_inode (block_sector_t sector)
+{
+  struct inode *inode = inode_open (sector);
+
+  if (inode != NULL)
+    {
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  else
+    free_map_release (sector, 1);
+}
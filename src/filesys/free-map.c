@@ -1,12 +1,282 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <random.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* The free map.
+
+   The bitmap, one bit per sector, is the authoritative record
+   of which sectors are in use, and is what is stored on disk.
+   To allocate quickly, the free sectors are also indexed in
+   memory as a set of maximal free extents, kept in a treap
+   ordered by starting sector in which each node also records
+   the length of the longest extent in its subtree.  That finds
+   the first extent at or after a given sector that is long
+   enough for a request in O(log n) expected time, and finds the
+   neighbors that a released run merges with just as fast.
+
+   Allocation is next-fit: it starts from where the previous
+   allocation ended, so that sectors allocated one after another
+   tend to be contiguous on disk.
+
+   Changes to the bitmap are not written to disk right away.
+   Instead, the sectors of the free map file that hold changed
+   bits are marked dirty and written by free_map_flush(), which
+   the journal calls at the end of each operation, so that they
+   commit along with the rest of the operation's changes.
+
+   Released sectors become free in the bitmap right away, but are
+   only indexed, and so reused, after the next journal
+   checkpoint.  See journal.c for why.
+
+   Reserved sectors (see struct reservation) are taken out of the
+   index but not set in the bitmap, so they are lost neither to a
+   crash nor to other files: when an allocation finds no free
+   sectors in the index, it reclaims every reservation not in
+   use and tries again. */
+
+/* A maximal run of free sectors. */
+struct extent
+  {
+    block_sector_t start;       /* First sector. */
+    block_sector_t length;      /* Number of sectors. */
+    block_sector_t max_length;  /* Longest length in this subtree. */
+    unsigned long priority;     /* Treap heap priority. */
+    struct extent *left;        /* Extents that start earlier. */
+    struct extent *right;       /* Extents that start later. */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty_map;     /* One bit per free map file sector. */
+static struct extent *extents;       /* Root of the free extent treap. */
+static struct extent *pending;       /* Released runs, linked by right. */
+static block_sector_t next_fit;      /* Where to start looking. */
+static struct list reservations;     /* Nonempty reservations. */
+static struct lock free_map_lock;    /* Guards all of the above. */
+
+/* Number of free map bits in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Recomputes E's max_length from E and its children. */
+static void
+update (struct extent *e)
+{
+  e->max_length = e->length;
+  if (e->left != NULL && e->left->max_length > e->max_length)
+    e->max_length = e->left->max_length;
+  if (e->right != NULL && e->right->max_length > e->max_length)
+    e->max_length = e->right->max_length;
+}
+
+/* Splits treap T into *LEFT, holding the extents that start
+   before SECTOR, and *RIGHT, holding the rest. */
+static void
+split (struct extent *t, block_sector_t sector,
+       struct extent **left, struct extent **right)
+{
+  if (t == NULL)
+    *left = *right = NULL;
+  else if (t->start < sector)
+    {
+      split (t->right, sector, &t->right, right);
+      update (t);
+      *left = t;
+    }
+  else
+    {
+      split (t->left, sector, left, &t->left);
+      update (t);
+      *right = t;
+    }
+}
+
+/* Joins treaps LEFT and RIGHT, where every extent in LEFT starts
+   before every extent in RIGHT, and returns the result. */
+static struct extent *
+merge (struct extent *left, struct extent *right)
+{
+  if (left == NULL)
+    return right;
+  if (right == NULL)
+    return left;
+  if (left->priority > right->priority)
+    {
+      left->right = merge (left->right, right);
+      update (left);
+      return left;
+    }
+  else
+    {
+      right->left = merge (left, right->left);
+      update (right);
+      return right;
+    }
+}
+
+/* Adds E, which must not overlap any extent, to the treap. */
+static void
+insert_extent (struct extent *e)
+{
+  struct extent *left, *right;
+
+  e->left = e->right = NULL;
+  update (e);
+  split (extents, e->start, &left, &right);
+  extents = merge (merge (left, e), right);
+}
+
+/* Removes the extent that starts at SECTOR from the treap and
+   returns it, or returns a null pointer if there is none. */
+static struct extent *
+remove_extent (block_sector_t sector)
+{
+  struct extent *left, *middle, *right;
+
+  split (extents, sector, &left, &middle);
+  split (middle, sector + 1, &middle, &right);
+  extents = merge (left, right);
+  return middle;
+}
+
+/* Returns the extent in T that starts first at or after SECTOR
+   among those at least CNT sectors long, or a null pointer if
+   there is none. */
+static struct extent *
+find_fit (struct extent *t, block_sector_t sector, size_t cnt)
+{
+  while (t != NULL && t->max_length >= cnt)
+    {
+      if (t->start < sector)
+        t = t->right;
+      else
+        {
+          struct extent *e = find_fit (t->left, sector, cnt);
+          if (e != NULL)
+            return e;
+          if (t->length >= cnt)
+            return t;
+          t = t->right;
+        }
+    }
+  return NULL;
+}
+
+/* Returns the extent in the treap that ends exactly at SECTOR,
+   or a null pointer if there is none. */
+static struct extent *
+find_ending_at (block_sector_t sector)
+{
+  struct extent *t = extents, *prev = NULL;
+
+  while (t != NULL)
+    if (t->start < sector)
+      {
+        prev = t;
+        t = t->right;
+      }
+    else
+      t = t->left;
+  return prev != NULL && prev->start + prev->length == sector ? prev : NULL;
+}
+
+/* Frees every extent in treap T. */
+static void
+destroy_extents (struct extent *t)
+{
+  if (t != NULL)
+    {
+      destroy_extents (t->left);
+      destroy_extents (t->right);
+      free (t);
+    }
+}
+
+/* Indexes the CNT free sectors starting at SECTOR, merging them
+   with the extents on either side.  If memory is short, the
+   sectors are left out of the index; they stay free in the
+   bitmap and so are indexed again the next time the free map is
+   opened. */
+static void
+add_free (block_sector_t sector, size_t cnt)
+{
+  struct extent *before = find_ending_at (sector);
+  struct extent *after = remove_extent (sector + cnt);
+
+  if (before != NULL)
+    {
+      before = remove_extent (before->start);
+      before->length += cnt;
+      if (after != NULL)
+        {
+          before->length += after->length;
+          free (after);
+        }
+      insert_extent (before);
+    }
+  else if (after != NULL)
+    {
+      after->start = sector;
+      after->length += cnt;
+      insert_extent (after);
+    }
+  else
+    {
+      struct extent *e = malloc (sizeof *e);
+      if (e == NULL)
+        return;
+      e->start = sector;
+      e->length = cnt;
+      e->priority = random_ulong ();
+      insert_extent (e);
+    }
+}
+
+/* Rebuilds the extent index from the bitmap.  Reserved sectors
+   are free in the bitmap, so every reservation is dropped. */
+static void
+build_extents (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start = 0;
+
+  while (!list_empty (&reservations))
+    {
+      struct reservation *r = list_entry (list_pop_front (&reservations),
+                                          struct reservation, elem);
+      r->cnt = 0;
+    }
+  destroy_extents (extents);
+  destroy_extents (pending);
+  extents = pending = NULL;
+  while ((start = bitmap_scan (free_map, start, 1, false)) != BITMAP_ERROR)
+    {
+      size_t end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      add_free (start, end - start);
+      start = end;
+    }
+  next_fit = 0;
+}
+
+/* Marks the sectors of the free map file that hold the bits for
+   the CNT sectors starting at SECTOR as needing to be written. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
 
 /* Initializes the free map. */
 void
@@ -15,38 +285,259 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+  list_init (&reservations);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  build_extents ();
+}
+
+/* Returns every reservation that is not pinned to the index.
+   The caller must hold free_map_lock. */
+static void
+reclaim_reservations (void)
+{
+  struct list_elem *e, *next;
+
+  for (e = list_begin (&reservations); e != list_end (&reservations);
+       e = next)
+    {
+      struct reservation *r = list_entry (e, struct reservation, elem);
+      next = list_next (e);
+      if (!r->pinned)
+        {
+          list_remove (&r->elem);
+          add_free (r->start, r->cnt);
+          r->cnt = 0;
+        }
+    }
+}
+
+/* Takes a run of CNT free sectors out of the index, next-fit,
+   and stores the first into *SECTORP.  If RECLAIM is true and no
+   run is long enough, reclaims reservations and tries again.
+   Returns true if successful, false if not enough consecutive
+   sectors were available.  The caller must hold
+   free_map_lock. */
+static bool
+take_extent (size_t cnt, block_sector_t *sectorp, bool reclaim)
+{
+  struct extent *e;
+  block_sector_t sector;
+
+  e = find_fit (extents, next_fit, cnt);
+  if (e == NULL)
+    e = find_fit (extents, 0, cnt);
+  if (e == NULL && reclaim && !list_empty (&reservations))
+    {
+      reclaim_reservations ();
+      e = find_fit (extents, 0, cnt);
+    }
+  if (e == NULL)
+    return false;
+
+  sector = e->start;
+  e = remove_extent (sector);
+  if (e->length > cnt)
+    {
+      e->start += cnt;
+      e->length -= cnt;
+      insert_extent (e);
+    }
+  else
+    free (e);
+
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  next_fit = sector + cnt;
+  *sectorp = sector;
+  return true;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  bool success;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  success = take_extent (cnt, sectorp, true);
+  if (success)
+    {
+      bitmap_set_multiple (free_map, *sectorp, cnt, true);
+      mark_dirty (*sectorp, cnt);
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Initializes R as an empty, unpinned reservation. */
+void
+free_map_reserve_init (struct reservation *r)
+{
+  r->cnt = 0;
+  r->pinned = false;
+}
+
+/* Reserves a run of free sectors in R, which must be empty: CNT
+   of them, or half as many as often as it takes to find a run,
+   reclaiming other reservations if there is not even one free
+   sector.  Returns true if successful, false if the disk is
+   full. */
+bool
+free_map_reserve (struct reservation *r, size_t cnt)
+{
+  bool success = false;
+
+  ASSERT (r->cnt == 0);
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  for (; cnt > 0 && !success; cnt /= 2)
+    if (take_extent (cnt, &r->start, cnt == 1))
+      {
+        r->cnt = cnt;
+        list_push_back (&reservations, &r->elem);
+        success = true;
+      }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates the first sector reserved in R and stores it into
+   *SECTORP.  Returns true if successful, false if R is empty. */
+bool
+free_map_take (struct reservation *r, block_sector_t *sectorp)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (r->cnt > 0)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      ASSERT (!bitmap_test (free_map, r->start));
+      bitmap_mark (free_map, r->start);
+      mark_dirty (r->start, 1);
+      *sectorp = r->start++;
+      if (--r->cnt == 0)
+        list_remove (&r->elem);
+      success = true;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Returns the sectors left in R to the index.  They were never
+   in use, so unlike released sectors they can be reused right
+   away. */
+void
+free_map_unreserve (struct reservation *r)
+{
+  lock_acquire (&free_map_lock);
+  if (r->cnt > 0)
+    {
+      list_remove (&r->elem);
+      add_free (r->start, r->cnt);
+      r->cnt = 0;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Keeps R from being reclaimed until free_map_unpin(). */
+void
+free_map_pin (struct reservation *r)
+{
+  lock_acquire (&free_map_lock);
+  r->pinned = true;
+  lock_release (&free_map_lock);
+}
+
+/* Lets R be reclaimed again. */
+void
+free_map_unpin (struct reservation *r)
+{
+  lock_acquire (&free_map_lock);
+  r->pinned = false;
+  lock_release (&free_map_lock);
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, as of
+   the next call to free_map_reclaim().  If memory is short,
+   they are only reused after the free map is next opened. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  struct extent *e;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  e = malloc (sizeof *e);
+  if (e != NULL)
+    {
+      e->start = sector;
+      e->length = cnt;
+      e->left = NULL;
+      e->right = pending;
+      pending = e;
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Makes the sectors released since the last call available for
+   allocation.  Called by the journal after a checkpoint. */
+void
+free_map_reclaim (void)
+{
+  lock_acquire (&free_map_lock);
+  while (pending != NULL)
+    {
+      struct extent *e = pending;
+      pending = e->right;
+      add_free (e->start, e->length);
+      free (e);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Writes the parts of the free map that have changed since they
+   were last written, through the journal.  Must be called within
+   a journal operation.  Panics if they cannot be written. */
+void
+free_map_flush (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t first = 0;
+
+  lock_acquire (&free_map_lock);
+  while (free_map_file != NULL
+         && (first = bitmap_scan (dirty_map, first, 1, true)) != BITMAP_ERROR)
+    {
+      size_t last = bitmap_scan (dirty_map, first, 1, false);
+      size_t start, cnt;
+
+      if (last == BITMAP_ERROR)
+        last = bitmap_size (dirty_map);
+      start = first * BITS_PER_SECTOR;
+      cnt = (last * BITS_PER_SECTOR < size ? last * BITS_PER_SECTOR : size)
+            - start;
+      if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+        PANIC ("can't write free map");
+      bitmap_set_multiple (dirty_map, first, last - first, false);
+      first = last;
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +549,19 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  build_extents ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  journal_begin ();
+  free_map_flush ();
+  journal_end ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,14 +569,30 @@ free_map_close (void)
 void
 free_map_create (void) 
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  /* Write bitmap to file.  The new file is a hole, so the first
+     write allocates its sectors, which changes the map as it is
+     being written; write it again to capture the final state.
+     From then on the file is fully allocated, so writing it never
+     has to allocate.  free_map_file stays null until then, so that
+     those allocations do not try to write the map themselves. */
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, file) || !bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+
+  /* Closing the file returns the sectors that were reserved for
+     it but not used to the free map. */
+  file_close (file);
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
+    PANIC ("can't open free map");
+  free_map_file = file;
 }
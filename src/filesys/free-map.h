@@ -3,15 +3,40 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <list.h>
 #include "devices/block.h"
 
+/* A run of free sectors set aside for one inode's data, so that
+   the sectors it takes one at a time are contiguous on disk.
+   Reserved sectors are only set aside in memory: they stay free
+   in the bitmap until they are taken, so a crash loses none of
+   them.  While a reservation is not pinned, an allocation that
+   finds no free sectors may reclaim it.  Its owner may read
+   START and CNT only while it is pinned. */
+struct reservation
+  {
+    struct list_elem elem;      /* Element in reservations list. */
+    block_sector_t start;       /* First reserved sector. */
+    size_t cnt;                 /* Number of reserved sectors. */
+    bool pinned;                /* Not to be reclaimed? */
+  };
+
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_reclaim (void);
+
+void free_map_reserve_init (struct reservation *);
+bool free_map_reserve (struct reservation *, size_t);
+bool free_map_take (struct reservation *, block_sector_t *);
+void free_map_unreserve (struct reservation *);
+void free_map_pin (struct reservation *);
+void free_map_unpin (struct reservation *);
 
 #endif /* filesys/free-map.h */
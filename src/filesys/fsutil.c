@@ -109,7 +109,11 @@ fsutil_extract (char **argv UNUSED)
           break;
         }
       else if (type == USTAR_DIRECTORY)
-        printf ("ignoring directory %s\n", file_name);
+        {
+          printf ("Making directory '%s'...\n", file_name);
+          if (!filesys_mkdir (file_name))
+            PANIC ("%s: mkdir failed", file_name);
+        }
       else if (type == USTAR_REGULAR)
         {
           struct file *dst;
@@ -1,23 +1,57 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include <uio.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct sector pointers in an inode. */
+#define DIRECT_CNT 123
+
+/* Number of sector pointers in an indirect block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Maximum number of data sectors in a file. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/* Maximum length of a file in bytes. */
+#define MAX_LENGTH ((off_t) (MAX_SECTORS * BLOCK_SECTOR_SIZE))
+
+/* Most data sectors that inode_write_at() writes in one
+   journal operation.  Bounds the number of index blocks and free
+   map sectors that the operation changes. */
+#define MAX_OP_RUN 64
+
+/* Minimum and maximum number of data sectors reserved for an
+   inode at a time.  See reserve_sectors(). */
+#define MIN_RESERVE 16
+#define MAX_RESERVE 256
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through direct pointers, then one
+   indirect block, then one doubly indirect block.  A pointer of 0
+   is a hole: it reads as zeros and gets a sector on its first
+   write.  (Sector 0 holds the free map inode, so it is never a
+   data or index sector.) */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect block. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t is_dir;                    /* Nonzero if a directory. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,49 +62,303 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* A copy of one of an inode's index blocks. */
+struct index_cache
+  {
+    block_sector_t sector;              /* Index block, 0 if none. */
+    block_sector_t *ptrs;               /* Its contents, or null. */
+  };
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes table. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loaded;                        /* Has DATA been read in yet? */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rwlock rwlock;               /* Guards data and deny_write_cnt. */
+    struct lock lock;                   /* Serializes directory updates. */
     struct inode_disk data;             /* Inode content. */
+
+    /* Data sectors set aside but not yet used, pinned and
+       guarded by rwlock while it is held for writing. */
+    struct reservation reserve;         /* Reserved sectors. */
+    size_t reserve_hint;                /* Sectors the current write needs. */
+
+    /* The index blocks used last, one whose entries are data
+       sectors and one whose entries are index blocks, so that
+       looking up a run of sectors reads each index block once.
+       Written through to the journal, and guarded by
+       index_lock. */
+    struct lock index_lock;
+    struct index_cache index_cache[2];
   };
 
+/* Data sectors are not allocated one at a time as writes fill
+   in holes, which would interleave the sectors of files that
+   grow at the same time.  Instead, when an inode first needs a
+   data sector, a contiguous run of free sectors big enough for
+   the whole write in progress, and at least MIN_RESERVE long, is
+   reserved for it, and data sectors are taken from the front of
+   the run until it is used up.  So a file written in many small
+   appends is still laid out contiguously.  Whatever is left of
+   the run goes back to the free map when the inode is last
+   closed, or earlier if another file runs out of space.  Index
+   blocks are allocated separately, so that they do not break up
+   runs of data. */
+
+/* Reserves a run of free sectors for INODE, which must have
+   none reserved.  Tries for INODE's reserve_hint sectors, within
+   [MIN_RESERVE, MAX_RESERVE], and settles for fewer if the free
+   map has no run that long.  Returns true if successful, false
+   if the disk is full. */
+static bool
+reserve_sectors (struct inode *inode)
+{
+  size_t cnt = inode->reserve_hint;
+
+  if (cnt < MIN_RESERVE)
+    cnt = MIN_RESERVE;
+  if (cnt > MAX_RESERVE)
+    cnt = MAX_RESERVE;
+  return free_map_reserve (&inode->reserve, cnt);
+}
+
+/* Allocates a sector for INODE and stores it in *SECTORP: a data
+   sector from INODE's reserved run if DATA is true, otherwise an
+   index block straight from the free map.  Returns true if
+   successful, false if the disk is full. */
+static bool
+allocate_sector (struct inode *inode, bool data, block_sector_t *sectorp)
+{
+  if (!data)
+    return free_map_allocate (1, sectorp);
+  if (inode->reserve.cnt == 0 && !reserve_sectors (inode))
+    return false;
+  return free_map_take (&inode->reserve, sectorp);
+}
+
+/* If *SLOTP, which belongs to INODE, is a hole and ALLOCATE is
+   true, allocates a sector for it and sets *CHANGED.  The new
+   sector is an index block, which is zeroed, if INDEX is true,
+   or a data sector otherwise.  Returns the sector in *SLOTP
+   afterward, which is 0 for a hole or if allocation fails. */
+static block_sector_t
+fill_slot (struct inode *inode, block_sector_t *slotp, bool allocate,
+           bool index, bool *changed)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  if (*slotp == 0 && allocate && allocate_sector (inode, !index, slotp))
+    {
+      if (index)
+        journal_write (*slotp, zeros);
+      *changed = true;
+    }
+  return *slotp;
+}
+
+/* Returns entry IDX of INODE's index block INDEX, like
+   fill_slot() with IS_INDEX. */
+static block_sector_t
+index_entry (struct inode *inode, block_sector_t index, size_t idx,
+             bool allocate, bool is_index)
+{
+  struct index_cache *c = &inode->index_cache[is_index];
+  block_sector_t sector = 0;
+  bool changed = false;
+
+  lock_acquire (&inode->index_lock);
+  if (c->ptrs == NULL)
+    c->ptrs = malloc (BLOCK_SECTOR_SIZE);
+  if (c->ptrs != NULL)
+    {
+      if (c->sector != index)
+        {
+          journal_read (index, c->ptrs);
+          c->sector = index;
+        }
+      sector = fill_slot (inode, &c->ptrs[idx], allocate, is_index,
+                          &changed);
+      if (changed)
+        journal_write (index, c->ptrs);
+    }
+  lock_release (&inode->index_lock);
+  return sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, which must be less than INODE's length.
+   Returns 0 if that part of INODE is a hole.  If ALLOCATE is
+   true, fills in the hole (and any index blocks leading to it)
+   first, and returns 0 only if allocation fails; the new data
+   sector is not zeroed.  The caller must hold INODE's rwlock,
+   for writing if ALLOCATE is true. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool allocate)
 {
+  struct inode_disk *d = &inode->data;
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t sector = 0;
+  bool changed = false;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  ASSERT (pos < d->length);
+
+  if (idx < DIRECT_CNT)
+    sector = fill_slot (inode, &d->direct[idx], allocate, false, &changed);
+  else if ((idx -= DIRECT_CNT) < PTRS_PER_SECTOR)
+    {
+      block_sector_t indirect = fill_slot (inode, &d->indirect, allocate,
+                                           true, &changed);
+      if (indirect != 0)
+        sector = index_entry (inode, indirect, idx, allocate, false);
+    }
   else
-    return -1;
+    {
+      block_sector_t dbl, indirect;
+
+      idx -= PTRS_PER_SECTOR;
+      dbl = fill_slot (inode, &d->doubly_indirect, allocate, true, &changed);
+      indirect = (dbl != 0
+                  ? index_entry (inode, dbl, idx / PTRS_PER_SECTOR,
+                                 allocate, true)
+                  : 0);
+      if (indirect != 0)
+        sector = index_entry (inode, indirect, idx % PTRS_PER_SECTOR,
+                              allocate, false);
+    }
+
+  if (changed)
+    journal_write (inode->sector, d);
+  return sector;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the length, in sectors, of the longest run of
+   consecutive disk sectors, at most MAX_CNT long, that holds
+   INODE's data starting at byte offset POS, given that POS is in
+   sector FIRST.  If ALLOCATE is true, holes are filled in as
+   long as the sector they get continues the run, and the caller
+   must overwrite every sector in the run; no sector past the
+   run is allocated. */
+static size_t
+contiguous_run (struct inode *inode, off_t pos, block_sector_t first,
+                size_t max_cnt, bool allocate)
+{
+  size_t cnt = 1;
+
+  while (cnt < max_cnt)
+    {
+      off_t next = pos + cnt * BLOCK_SECTOR_SIZE;
+      block_sector_t sector = byte_to_sector (inode, next, false);
+
+      /* A hole gets the front of the reserved run, so only fill
+         it in if that is the sector the run needs. */
+      if (sector == 0 && allocate && inode->reserve.cnt > 0
+          && inode->reserve.start == first + cnt)
+        sector = byte_to_sector (inode, next, true);
+      if (sector != first + cnt)
+        break;
+      cnt++;
+    }
+  return cnt;
+}
+
+/* Releases SECTOR, which is a data sector if LEVEL is 0 or an
+   index block with LEVEL levels of blocks below it otherwise,
+   along with everything it points to.  Does nothing for a
+   hole. */
+static void
+release_sectors (block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+
+  if (level > 0)
+    {
+      block_sector_t *block = malloc (BLOCK_SECTOR_SIZE);
+      size_t i;
+
+      /* On allocation failure, leak the blocks below rather than
+         corrupting the free map. */
+      if (block != NULL)
+        {
+          journal_read (sector, block);
+          for (i = 0; i < PTRS_PER_SECTOR; i++)
+            release_sectors (block[i], level - 1);
+          free (block);
+        }
+    }
+  free_map_release (sector, 1);
+}
+
+/* Returns true if INODE holds file system metadata, that is, if
+   it is a directory or the free map file.  The data sectors of
+   such an inode are read and written through the journal. */
+static bool
+is_metadata (const struct inode *inode)
+{
+  return inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Reads data SECTOR of INODE into BUFFER. */
+static void
+read_sector (const struct inode *inode, block_sector_t sector, void *buffer)
+{
+  if (is_metadata (inode))
+    journal_read (sector, buffer);
+  else
+    block_read (fs_device, sector, buffer);
+}
+
+/* Writes BUFFER to data SECTOR of INODE. */
+static void
+write_sector (const struct inode *inode, block_sector_t sector,
+              const void *buffer)
+{
+  if (is_metadata (inode))
+    journal_write (sector, buffer);
+  else
+    block_write (fs_device, sector, buffer);
+}
+
+/* Table of open inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt and loaded members of
+   every inode in it. */
+static struct lock open_inodes_lock;
+
+/* Signaled when an inode in open_inodes finishes loading. */
+static struct condition inode_loaded;
+
+static unsigned inode_hash (const struct hash_elem *, void *aux);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *aux);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("inode table creation failed");
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  IS_DIR tells whether the inode backs a directory.
+   The data starts out as one big hole, so only the inode itself
+   is written.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is too
+   large. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -81,25 +369,19 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (length > MAX_LENGTH)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+      disk_inode->is_dir = is_dir;
+      journal_begin ();
+      journal_write (sector, disk_inode);
+      journal_end ();
+      success = true;
       free (disk_inode);
     }
   return success;
@@ -111,33 +393,57 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (!inode->loaded)
+        cond_wait (&inode_loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loaded = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  free_map_reserve_init (&inode->reserve);
+  inode->reserve_hint = 0;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->lock);
+  lock_init (&inode->index_lock);
+  memset (inode->index_cache, 0, sizeof inode->index_cache);
+
+  /* Publish the inode before reading it in, so that the read does
+     not hold up opens and closes of other inodes.  Openers of this
+     one wait above until it is loaded. */
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+  journal_read (inode->sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loaded = true;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +452,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -168,21 +478,34 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
+      free_map_unreserve (&inode->reserve);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          size_t i;
+
+          journal_begin ();
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          for (i = 0; i < DIRECT_CNT; i++)
+            release_sectors (inode->data.direct[i], 0);
+          release_sectors (inode->data.indirect, 1);
+          release_sectors (inode->data.doubly_indirect, 2);
+          journal_end ();
         }
 
+      free (inode->index_cache[0].ptrs);
+      free (inode->index_cache[1].ptrs);
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -194,20 +517,21 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
-   Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+/* Reads SIZE bytes from INODE into BUFFER, starting at OFFSET,
+   for inode_read_at() and inode_readv_at().  The caller must hold
+   INODE's rwlock.  *BOUNCE is a bounce buffer allocated on first
+   use, which the caller frees. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset,
+         uint8_t **bounce) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -220,23 +544,36 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      sector_idx = byte_to_sector (inode, offset, false);
+      if (sector_idx == 0)
+        {
+          /* Holes read as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE
+               && !is_metadata (inode))
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Read full sectors directly into caller's buffer, as
+             many at once as are contiguous on disk. */
+          off_t left = size < inode_left ? size : inode_left;
+          size_t cnt = contiguous_run (inode, offset, sector_idx,
+                                       left / BLOCK_SECTOR_SIZE, false);
+          block_read_multiple (fs_device, sector_idx, cnt,
+                               buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
           /* Read sector into bounce buffer, then partially copy
              into caller's buffer. */
-          if (bounce == NULL) 
+          if (*bounce == NULL) 
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
+              *bounce = malloc (BLOCK_SECTOR_SIZE);
+              if (*bounce == NULL)
                 break;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          read_sector (inode, sector_idx, *bounce);
+          memcpy (buffer + bytes_read, *bounce + sector_ofs, chunk_size);
         }
       
       /* Advance. */
@@ -244,31 +581,83 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
+  return bytes_read;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+   Returns the number of bytes actually read, which may be less
+   than SIZE if an error occurs or end of file is reached. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+  uint8_t *bounce = NULL;
+  off_t bytes_read;
+
+  rwlock_acquire_read (&inode->rwlock);
+  bytes_read = read_at (inode, buffer, size, offset, &bounce);
+  rwlock_release_read (&inode->rwlock);
   free (bounce);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+/* Reads from INODE into the IOVCNT buffers in IOV, in order,
+   starting at position OFFSET, as one atomic read.  Returns the
+   number of bytes actually read, which may be less than the total
+   size of the buffers if an error occurs or end of file is
+   reached. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_readv_at (struct inode *inode, const struct iovec *iov, int iovcnt,
                 off_t offset) 
 {
-  const uint8_t *buffer = buffer_;
-  off_t bytes_written = 0;
   uint8_t *bounce = NULL;
+  off_t bytes_read = 0;
+  int i;
 
-  if (inode->deny_write_cnt)
-    return 0;
+  rwlock_acquire_read (&inode->rwlock);
+  for (i = 0; i < iovcnt; i++) 
+    {
+      off_t cnt = read_at (inode, iov[i].iov_base, iov[i].iov_len,
+                           offset + bytes_read, &bounce);
+      bytes_read += cnt;
+      if (cnt < (off_t) iov[i].iov_len)
+        break;
+    }
+  rwlock_release_read (&inode->rwlock);
+  free (bounce);
+
+  return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   for inode_write_at() and inode_writev_at().  The caller must
+   hold INODE's rwlock for writing.  *BOUNCE is a bounce buffer
+   allocated on first use, which the caller frees. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
+          off_t offset, uint8_t **bounce) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+  off_t old_length;
+
+  /* Extend the inode first, so that the loop below can write past
+     the old end of file, and trim it back afterward to what was
+     actually written. */
+  old_length = inode->data.length;
+  if (size > 0 && offset < MAX_LENGTH && size > old_length - offset)
+    inode->data.length = (size < MAX_LENGTH - offset
+                          ? offset + size : MAX_LENGTH);
+  inode->reserve_hint = (size < MAX_LENGTH
+                         ? bytes_to_sectors (offset % BLOCK_SECTOR_SIZE + size)
+                         : MAX_RESERVE);
+  free_map_pin (&inode->reserve);
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
+      bool was_hole;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -281,37 +670,133 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Each chunk is its own journal operation, so that a long
+         write does not overflow the log.  The operation only
+         allocates the data sectors that it writes, and writes
+         them before it commits, so a committed pointer never
+         leads to stale data. */
+      journal_begin ();
+
+      /* Fill in a hole on first write. */
+      sector_idx = byte_to_sector (inode, offset, false);
+      was_hole = sector_idx == 0;
+      if (was_hole)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          sector_idx = byte_to_sector (inode, offset, true);
+          if (sector_idx == 0)
+            {
+              journal_end ();
+              break;
+            }
+        }
+
+      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE
+          && !is_metadata (inode))
+        {
+          /* Write full sectors directly to disk, as many at once
+             as are contiguous on disk. */
+          off_t left = size < inode_left ? size : inode_left;
+          size_t cnt = left / BLOCK_SECTOR_SIZE;
+          if (cnt > MAX_OP_RUN)
+            cnt = MAX_OP_RUN;
+          cnt = contiguous_run (inode, offset, sector_idx, cnt, true);
+          block_write_multiple (fs_device, sector_idx, cnt,
+                                buffer + bytes_written);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
           /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          if (*bounce == NULL) 
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              *bounce = malloc (BLOCK_SECTOR_SIZE);
+              if (*bounce == NULL)
+                {
+                  journal_end ();
+                  break;
+                }
             }
 
           /* If the sector contains data before or after the chunk
              we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
+             first.  Otherwise, or if the sector was a hole, we
+             start with a sector of all zeros. */
+          if (!was_hole && (sector_ofs > 0 || chunk_size < sector_left))
+            read_sector (inode, sector_idx, *bounce);
           else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+            memset (*bounce, 0, BLOCK_SECTOR_SIZE);
+          memcpy (*bounce + sector_ofs, buffer + bytes_written, chunk_size);
+          write_sector (inode, sector_idx, *bounce);
         }
+      journal_end ();
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
+
+  /* OFFSET is now the end of what was written. */
+  if (inode->data.length > old_length)
+    {
+      if (offset < inode->data.length)
+        inode->data.length = offset > old_length ? offset : old_length;
+      if (inode->data.length > old_length)
+        {
+          journal_begin ();
+          journal_write (inode->sector, &inode->data);
+          journal_end ();
+        }
+    }
+  free_map_unpin (&inode->reserve);
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the maximum file size is reached or an error
+   occurs.  A write past end of file extends the inode; any gap
+   between the old end of file and OFFSET becomes a hole. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset) 
+{
+  uint8_t *bounce = NULL;
+  off_t bytes_written = 0;
+
+  rwlock_acquire_write (&inode->rwlock);
+  if (!inode->deny_write_cnt)
+    bytes_written = write_at (inode, buffer, size, offset, &bounce);
+  rwlock_release_write (&inode->rwlock);
+  free (bounce);
+
+  return bytes_written;
+}
+
+/* Writes the IOVCNT buffers in IOV into INODE, in order, starting
+   at OFFSET, as one atomic write.  Returns the number of bytes
+   actually written, which may be less than the total size of the
+   buffers if the maximum file size is reached or an error
+   occurs. */
+off_t
+inode_writev_at (struct inode *inode, const struct iovec *iov, int iovcnt,
+                 off_t offset) 
+{
+  uint8_t *bounce = NULL;
+  off_t bytes_written = 0;
+  int i;
+
+  rwlock_acquire_write (&inode->rwlock);
+  if (!inode->deny_write_cnt)
+    for (i = 0; i < iovcnt; i++) 
+      {
+        off_t cnt = write_at (inode, iov[i].iov_base, iov[i].iov_len,
+                              offset + bytes_written, &bounce);
+        bytes_written += cnt;
+        if (cnt < (off_t) iov[i].iov_len)
+          break;
+      }
+  rwlock_release_write (&inode->rwlock);
   free (bounce);
 
   return bytes_written;
@@ -322,8 +807,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +819,40 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
+}
+
+/* Returns true if INODE backs a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE has been removed from its directory. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Acquires INODE's directory lock, which serializes changes to
+   the entries of the directory that INODE backs. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +861,22 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Returns a hash value for the inode containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if the inode containing A is on a lower sector
+   than the inode containing B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct inode *inode_a = hash_entry (a, struct inode, elem);
+  const struct inode *inode_b = hash_entry (b, struct inode, elem);
+  return inode_a->sector < inode_b->sector;
+}
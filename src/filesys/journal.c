@@ -0,0 +1,482 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Metadata journal.
+
+   Every change to file system metadata (inodes, index blocks,
+   directory buckets, and the free map) is made as part of an
+   operation bracketed by journal_begin() and journal_end().
+   Instead of writing a metadata sector to its home location,
+   journal_write() keeps the new contents in memory as part of
+   the current transaction, where journal_read() will find them.
+
+   Operations that run at the same time join the same
+   transaction, which is committed when the last of them ends:
+   the transaction's sectors are written to the next free slots
+   of the on-disk log, one sequential run, and then the log
+   header, which lists the home sector of every slot in use, is
+   rewritten to include them.  Writing the header is what makes
+   the transaction durable, all at once.  A sector changed again
+   before it is committed is only logged once.
+
+   Committed sectors stay in memory, and are only written to
+   their home locations by a checkpoint, once the log is half
+   full, after which the log is empty again.  Sectors changed
+   many times in between, such as those of a directory that
+   many files are created in, are written home only once.  If
+   the system stops before a checkpoint, journal_init() replays
+   the log when the file system is next mounted.
+
+   Sectors freed by a transaction are not reused until the
+   next checkpoint (see free_map_release()), so that a logged
+   copy of a sector is never replayed over data written to it
+   after it was reused. */
+
+/* Number of log slots. */
+#define LOG_CAPACITY (JOURNAL_SECTORS - 1)
+
+/* Most sectors that a single operation may change, unless it
+   asks for more with journal_reserve(). */
+#define MAX_OP_SECTORS 16
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* On-disk log header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                         /* JOURNAL_MAGIC. */
+    uint32_t cnt;                           /* Number of slots in use. */
+    block_sector_t sectors[LOG_CAPACITY];   /* Home sector of each slot. */
+  };
+
+/* The latest contents of a sector that has been written through
+   the journal since the last checkpoint. */
+struct jsector
+  {
+    struct hash_elem hash_elem;         /* Element in sectors. */
+    struct list_elem list_elem;         /* Element in free_jsectors. */
+    block_sector_t sector;              /* Home sector. */
+    bool in_txn;                        /* Changed in current transaction? */
+    struct block_request req;           /* For writing to disk. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Contents. */
+  };
+
+/* There is never more than one jsector per log slot in use or
+   reserved, so this many always suffice. */
+static struct jsector *jsectors;
+static struct list free_jsectors;
+
+static bool enabled;                    /* False while formatting. */
+static struct journal_header *header;   /* In-memory log header. */
+static struct hash sectors;             /* jsectors in use. */
+static struct jsector *txn[LOG_CAPACITY]; /* Current transaction. */
+static size_t txn_cnt;                  /* Number of sectors in txn. */
+static int outstanding;                 /* Operations in progress. */
+static size_t reserved;                 /* Log slots that operations in
+                                           progress may still fill. */
+static bool committing;                 /* Commit in progress? */
+static struct lock journal_lock;        /* Guards all of the above. */
+static struct condition can_begin;      /* Signaled when a new operation
+                                           may be able to begin. */
+
+/* Statistics. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Sectors written to the log. */
+static unsigned long long op_cnt;       /* Operations completed. */
+static unsigned long long checkpoint_cnt; /* Checkpoints made. */
+
+/* See journal.h. */
+bool journal_no_checkpoint;
+
+static unsigned jsector_hash (const struct hash_elem *, void *);
+static bool jsector_less (const struct hash_elem *, const struct hash_elem *,
+                          void *);
+static void commit (void);
+static void checkpoint (void);
+
+/* Initializes the journal.  If FORMAT is true, the file system
+   was just formatted, so starts with an empty log; otherwise,
+   replays whatever transactions the log holds, in case the
+   system stopped before they were checkpointed. */
+void
+journal_init (bool format)
+{
+  size_t i;
+
+  ASSERT (sizeof *header == BLOCK_SECTOR_SIZE);
+
+  header = malloc (sizeof *header);
+  jsectors = malloc (LOG_CAPACITY * sizeof *jsectors);
+  if (header == NULL || jsectors == NULL
+      || !hash_init (&sectors, jsector_hash, jsector_less, NULL))
+    PANIC ("journal initialization failed");
+  list_init (&free_jsectors);
+  for (i = 0; i < LOG_CAPACITY; i++)
+    list_push_back (&free_jsectors, &jsectors[i].list_elem);
+  lock_init (&journal_lock);
+  cond_init (&can_begin);
+
+  block_read (fs_device, JOURNAL_SECTOR, header);
+  if (!format && header->magic == JOURNAL_MAGIC && header->cnt > 0)
+    {
+      uint8_t *buffer = malloc (BLOCK_SECTOR_SIZE);
+      if (buffer == NULL || header->cnt > LOG_CAPACITY)
+        PANIC ("can't replay journal");
+
+      /* Replay in order, so that the last copy of a sector logged
+         more than once wins. */
+      printf ("journal: replaying %"PRIu32" sectors\n", header->cnt);
+      for (i = 0; i < header->cnt; i++)
+        {
+          block_read (fs_device, JOURNAL_SECTOR + 1 + i, buffer);
+          block_write (fs_device, header->sectors[i], buffer);
+        }
+      free (buffer);
+    }
+  memset (header, 0, sizeof *header);
+  header->magic = JOURNAL_MAGIC;
+  block_write (fs_device, JOURNAL_SECTOR, header);
+  enabled = true;
+}
+
+/* Commits everything and writes it to its home location, so
+   that the log is empty, unless journal_no_checkpoint is set. */
+void
+journal_done (void)
+{
+  if (!enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing || outstanding > 0)
+    cond_wait (&can_begin, &journal_lock);
+  committing = true;
+  lock_release (&journal_lock);
+
+  commit ();
+  if (!journal_no_checkpoint)
+    checkpoint ();
+  enabled = false;
+  printf ("journal: %llu operations in %llu commits, %llu sectors logged, "
+          "%llu checkpoints\n",
+          op_cnt, commit_cnt, logged_cnt, checkpoint_cnt);
+  if (journal_no_checkpoint)
+    printf ("journal: stopping with %"PRIu32" sectors in the log\n",
+            header->cnt);
+}
+
+/* Begins an operation that changes metadata.  Every metadata
+   change must be made between a call to this function and a
+   matching call to journal_end().  Calls may nest; only the
+   outermost pair counts.  The operation may add up to
+   MAX_OP_SECTORS sectors to the transaction, or more if
+   journal_reserve() allows.  May wait for a commit in progress
+   or for room in the log, so the outermost call must not be made
+   while holding a lock that an operation in progress might
+   need. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled || t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing
+         || header->cnt + txn_cnt + reserved + MAX_OP_SECTORS > LOG_CAPACITY)
+    cond_wait (&can_begin, &journal_lock);
+  outstanding++;
+  reserved += MAX_OP_SECTORS;
+  t->journal_room = MAX_OP_SECTORS;
+  lock_release (&journal_lock);
+}
+
+/* Makes sure that the current operation may still add CNT more
+   sectors to the transaction, taking more room in the log if
+   there is enough without waiting.  Returns true if successful,
+   false if the caller must make do without changing that many
+   sectors, in which case nothing is reserved.  Must be called
+   within an operation. */
+bool
+journal_reserve (size_t cnt)
+{
+  struct thread *t = thread_current ();
+  bool success;
+
+  if (!enabled)
+    return true;
+  ASSERT (t->journal_depth > 0);
+  if (cnt <= t->journal_room)
+    return true;
+
+  lock_acquire (&journal_lock);
+  success = (header->cnt + txn_cnt + reserved + (cnt - t->journal_room)
+             <= LOG_CAPACITY);
+  if (success)
+    {
+      reserved += cnt - t->journal_room;
+      t->journal_room = cnt;
+    }
+  lock_release (&journal_lock);
+  return success;
+}
+
+/* Ends an operation begun with journal_begin().  If it was the
+   last one in progress, commits the current transaction, which
+   includes it, before returning. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  bool do_commit;
+
+  if (!enabled)
+    return;
+  ASSERT (t->journal_depth > 0);
+  if (t->journal_depth > 1)
+    {
+      t->journal_depth--;
+      return;
+    }
+
+  /* Log the parts of the free map that the operation changed
+     while it is still in progress, so that they commit with
+     it. */
+  free_map_flush ();
+  t->journal_depth = 0;
+
+  lock_acquire (&journal_lock);
+  reserved -= t->journal_room;
+  t->journal_room = 0;
+  op_cnt++;
+  do_commit = --outstanding == 0;
+  if (do_commit)
+    committing = true;
+  else
+    cond_broadcast (&can_begin, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (do_commit)
+    {
+      bool do_checkpoint;
+
+      commit ();
+      do_checkpoint = header->cnt > LOG_CAPACITY / 2;
+      if (do_checkpoint)
+        checkpoint ();
+
+      lock_acquire (&journal_lock);
+      committing = false;
+      cond_broadcast (&can_begin, &journal_lock);
+      lock_release (&journal_lock);
+
+      if (do_checkpoint)
+        free_map_reclaim ();
+    }
+}
+
+/* Returns the jsector for SECTOR, or a null pointer if SECTOR
+   has not been written through the journal since the last
+   checkpoint.  The caller must hold journal_lock. */
+static struct jsector *
+find (block_sector_t sector)
+{
+  struct jsector key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&sectors, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct jsector, hash_elem) : NULL;
+}
+
+/* Reads metadata SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes, including any changes made to it
+   through the journal that have not reached its home location
+   yet. */
+void
+journal_read (block_sector_t sector, void *buffer)
+{
+  struct jsector *js = NULL;
+
+  if (enabled)
+    {
+      lock_acquire (&journal_lock);
+      js = find (sector);
+      if (js != NULL)
+        memcpy (buffer, js->data, BLOCK_SECTOR_SIZE);
+      lock_release (&journal_lock);
+    }
+  if (js == NULL)
+    block_read (fs_device, sector, buffer);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to metadata
+   SECTOR as part of the current transaction.  Must be called
+   within an operation that has room left for SECTOR, if it is
+   not in the transaction already. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  struct thread *t = thread_current ();
+  struct jsector *js;
+
+  if (!enabled)
+    {
+      block_write (fs_device, sector, buffer);
+      return;
+    }
+  ASSERT (t->journal_depth > 0);
+
+  /* Every jsector in use holds a log slot in use or reserved, so
+     an operation within its room never runs out of either. */
+  lock_acquire (&journal_lock);
+  js = find (sector);
+  if (js == NULL)
+    {
+      ASSERT (!list_empty (&free_jsectors));
+      js = list_entry (list_pop_front (&free_jsectors),
+                       struct jsector, list_elem);
+      js->sector = sector;
+      js->in_txn = false;
+      hash_insert (&sectors, &js->hash_elem);
+    }
+  if (!js->in_txn)
+    {
+      ASSERT (t->journal_room > 0);
+      ASSERT (header->cnt + txn_cnt < LOG_CAPACITY);
+      t->journal_room--;
+      reserved--;
+      txn[txn_cnt++] = js;
+      js->in_txn = true;
+    }
+  memcpy (js->data, buffer, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+}
+
+/* Completion function for the writes made by commit() and
+   checkpoint(). */
+static void
+write_done (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Writes JS's contents to SECTOR without waiting, and ups DONE
+   once the write is complete. */
+static void
+start_write (struct jsector *js, block_sector_t sector,
+             struct semaphore *done)
+{
+  block_request_init (&js->req, true, sector, 1, js->data, write_done, done);
+  block_submit (fs_device, &js->req);
+}
+
+/* Writes the current transaction to the log and then the header
+   that makes it durable.  The caller must have set committing
+   with no operations in progress. */
+static void
+commit (void)
+{
+  struct semaphore done;
+  size_t i;
+
+  ASSERT (committing && outstanding == 0);
+  if (txn_cnt == 0)
+    return;
+
+  /* The slots are consecutive, so the request queue merges these
+     writes into one transfer. */
+  sema_init (&done, 0);
+  for (i = 0; i < txn_cnt; i++)
+    {
+      size_t slot = header->cnt + i;
+      header->sectors[slot] = txn[i]->sector;
+      start_write (txn[i], JOURNAL_SECTOR + 1 + slot, &done);
+    }
+  for (i = 0; i < txn_cnt; i++)
+    sema_down (&done);
+
+  header->cnt += txn_cnt;
+  block_write (fs_device, JOURNAL_SECTOR, header);
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < txn_cnt; i++)
+    txn[i]->in_txn = false;
+  commit_cnt++;
+  logged_cnt += txn_cnt;
+  txn_cnt = 0;
+  lock_release (&journal_lock);
+}
+
+/* Returns the jsector in hash element E to the free list. */
+static void
+release_jsector (struct hash_elem *e, void *aux UNUSED)
+{
+  struct jsector *js = hash_entry (e, struct jsector, hash_elem);
+  list_push_back (&free_jsectors, &js->list_elem);
+}
+
+/* Writes every committed sector to its home location, in
+   whatever order the request queue finds fastest, and empties
+   the log.  The caller must have set committing with no
+   operations in progress and nothing left uncommitted. */
+static void
+checkpoint (void)
+{
+  struct hash_iterator i;
+  struct semaphore done;
+  size_t cnt = 0;
+
+  ASSERT (committing && outstanding == 0 && txn_cnt == 0);
+
+  sema_init (&done, 0);
+  hash_first (&i, &sectors);
+  while (hash_next (&i))
+    {
+      struct jsector *js = hash_entry (hash_cur (&i), struct jsector,
+                                       hash_elem);
+      start_write (js, js->sector, &done);
+      cnt++;
+    }
+  while (cnt-- > 0)
+    sema_down (&done);
+
+  header->cnt = 0;
+  block_write (fs_device, JOURNAL_SECTOR, header);
+  checkpoint_cnt++;
+
+  lock_acquire (&journal_lock);
+  hash_clear (&sectors, release_jsector);
+  lock_release (&journal_lock);
+}
+
+/* Returns a hash value for the jsector containing E. */
+static unsigned
+jsector_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct jsector *js = hash_entry (e, struct jsector, hash_elem);
+  return hash_int (js->sector);
+}
+
+/* Returns true if the jsector containing A has a lower sector
+   than the one containing B. */
+static bool
+jsector_less (const struct hash_elem *a, const struct hash_elem *b,
+              void *aux UNUSED)
+{
+  const struct jsector *js_a = hash_entry (a, struct jsector, hash_elem);
+  const struct jsector *js_b = hash_entry (b, struct jsector, hash_elem);
+  return js_a->sector < js_b->sector;
+}
@@ -0,0 +1,27 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Number of sectors in the journal, starting at JOURNAL_SECTOR:
+   a header sector followed by one sector per log slot. */
+#define JOURNAL_SECTORS 127
+
+/* If true, journal_done() leaves committed transactions in the
+   log instead of checkpointing them, as if the system had
+   stopped without warning, so that the next mount replays them.
+   Set by the kernel command-line option "-nocheckpoint". */
+extern bool journal_no_checkpoint;
+
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+bool journal_reserve (size_t);
+void journal_end (void);
+
+void journal_read (block_sector_t, void *);
+void journal_write (block_sector_t, const void *);
+
+#endif /* filesys/journal.h */
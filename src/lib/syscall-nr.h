@@ -28,7 +28,24 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_RING_ENTER,             /* Run queued system calls. */
+    SYS_READV,                  /* Read a file into several buffers. */
+    SYS_WRITEV,                 /* Write several buffers to a file. */
+    SYS_PREAD,                  /* Read from a file at a given position. */
+    SYS_PWRITE,                 /* Write to a file at a given position. */
+    SYS_COPY_FILE_RANGE,        /* Copy data from one file to another. */
+    SYS_PIPE,                   /* Create a pipe. */
+    SYS_FUTEX_WAIT,             /* Sleep on a futex word. */
+    SYS_FUTEX_WAKE,             /* Wake sleepers on a futex word. */
+    SYS_THREAD_SPAWN,           /* Start a thread in this process. */
+    SYS_THREAD_JOIN,            /* Wait for a thread to exit. */
+    SYS_THREAD_EXIT,            /* End the current thread. */
+    SYS_SHM_CREATE,             /* Create a shared memory segment. */
+    SYS_SHM_ATTACH,             /* Map a shared memory segment. */
+    SYS_SHM_DETACH              /* Unmap a shared memory segment. */
   };
 
 #endif /* lib/syscall-nr.h */
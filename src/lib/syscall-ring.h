@@ -0,0 +1,94 @@
+#ifndef __LIB_SYSCALL_RING_H
+#define __LIB_SYSCALL_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Submission and completion rings for batching system calls.
+
+   A process fills submission queue entries in a struct
+   syscall_ring in its own memory, then passes the ring to the
+   ring_enter() system call, which runs the queued calls one
+   after another and posts each result to the completion queue.
+   Only SYS_OPEN, SYS_FILESIZE, SYS_READ, SYS_WRITE, SYS_SEEK,
+   SYS_TELL, SYS_CLOSE, SYS_READV, SYS_WRITEV, and
+   SYS_COPY_FILE_RANGE may be queued; anything else completes
+   with result -1, and calls that return nothing complete with
+   result 0.  ring_enter() returns the number of calls run, or
+   -1 if the kernel cannot read or write the ring.
+
+   Head and tail indexes run freely and are reduced modulo
+   RING_ENTRIES to index the arrays.  The process advances
+   sq_tail and cq_head, the kernel sq_head and cq_tail. */
+
+/* Number of entries in each queue.  Must be a power of 2. */
+#define RING_ENTRIES 64
+
+/* Submission queue entry.  NUMBER and ARGS are laid out exactly
+   as they would be on the user stack for `int $0x30', so the
+   kernel dispatches the entry with the ordinary system call
+   handlers. */
+struct ring_sqe
+  {
+    uint32_t number;            /* System call number. */
+    uint32_t args[3];           /* Arguments. */
+    uint32_t user_data;         /* Copied to the completion. */
+  };
+
+/* Completion queue entry. */
+struct ring_cqe
+  {
+    uint32_t user_data;         /* From the submission. */
+    int32_t result;             /* System call return value. */
+  };
+
+struct syscall_ring
+  {
+    uint32_t sq_head, sq_tail;  /* Submission queue indexes. */
+    uint32_t cq_head, cq_tail;  /* Completion queue indexes. */
+    struct ring_sqe sq[RING_ENTRIES];
+    struct ring_cqe cq[RING_ENTRIES];
+  };
+
+/* Initializes RING to empty. */
+static inline void
+ring_init (struct syscall_ring *ring) 
+{
+  ring->sq_head = ring->sq_tail = 0;
+  ring->cq_head = ring->cq_tail = 0;
+}
+
+/* Queues system call NUMBER with arguments A0, A1, and A2 on
+   RING, tagged with USER_DATA.  Returns false if the submission
+   queue is full. */
+static inline bool
+ring_push (struct syscall_ring *ring, uint32_t number,
+           uint32_t a0, uint32_t a1, uint32_t a2, uint32_t user_data) 
+{
+  struct ring_sqe *sqe;
+
+  if (ring->sq_tail - ring->sq_head >= RING_ENTRIES)
+    return false;
+  sqe = &ring->sq[ring->sq_tail % RING_ENTRIES];
+  sqe->number = number;
+  sqe->args[0] = a0;
+  sqe->args[1] = a1;
+  sqe->args[2] = a2;
+  sqe->user_data = user_data;
+  ring->sq_tail++;
+  return true;
+}
+
+/* Removes the oldest completion from RING into *CQE.  Returns
+   false if the completion queue is empty. */
+static inline bool
+ring_pop (struct syscall_ring *ring, struct ring_cqe *cqe) 
+{
+  if (ring->cq_head == ring->cq_tail)
+    return false;
+  *cqe = ring->cq[ring->cq_head % RING_ENTRIES];
+  ring->cq_head++;
+  return true;
+}
+
+#endif /* lib/syscall-ring.h */
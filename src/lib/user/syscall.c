@@ -1,16 +1,30 @@
 #include <syscall.h>
 #include "../syscall-nr.h"
 
+/* How to trap into the kernel.  By default we use `int $0x30'.
+   Programs built with -DUSER_SYSENTER use the SYSENTER fast path
+   instead, passing the return address in %edx and the stack
+   pointer, which points to the system call number just as for
+   `int $0x30', in %ecx.  The kernel returns with SYSEXIT, which
+   clobbers both. */
+#ifdef USER_SYSENTER
+#define SYSCALL_TRAP "movl %%esp, %%ecx; movl $1f, %%edx; sysenter; 1: "
+#define SYSCALL_CLOBBERS "memory", "ecx", "edx"
+#else
+#define SYSCALL_TRAP "int $0x30; "
+#define SYSCALL_CLOBBERS "memory"
+#endif
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; " SYSCALL_TRAP "addl $4, %%esp"  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : SYSCALL_CLOBBERS);                             \
           retval;                                               \
         })
 
@@ -20,11 +34,12 @@
         ({                                                               \
           int retval;                                                    \
           asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
+            ("pushl %[arg0]; pushl %[number]; "                          \
+             SYSCALL_TRAP "addl $8, %%esp"                               \
                : "=a" (retval)                                           \
                : [number] "i" (NUMBER),                                  \
                  [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
+               : SYSCALL_CLOBBERS);                                      \
           retval;                                                        \
         })
 
@@ -35,12 +50,12 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP "addl $12, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1)                              \
-               : "memory");                                     \
+               : SYSCALL_CLOBBERS);                             \
           retval;                                               \
         })
 
@@ -51,13 +66,32 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP "addl $16, %%esp" \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
                  [arg0] "g" (ARG0),                             \
                  [arg1] "g" (ARG1),                             \
                  [arg2] "g" (ARG2)                              \
-               : "memory");                                     \
+               : SYSCALL_CLOBBERS);                             \
+          retval;                                               \
+        })
+
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; "                   \
+             "pushl %[arg1]; pushl %[arg0]; "                   \
+             "pushl %[number]; " SYSCALL_TRAP "addl $20, %%esp" \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [arg0] "g" (ARG0),                             \
+                 [arg1] "g" (ARG1),                             \
+                 [arg2] "g" (ARG2),                             \
+                 [arg3] "g" (ARG3)                              \
+               : SYSCALL_CLOBBERS);                             \
           retval;                                               \
         })
 
@@ -182,3 +216,103 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+ring_enter (struct syscall_ring *ring, unsigned to_submit) 
+{
+  return syscall2 (SYS_RING_ENTER, ring, to_submit);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt) 
+{
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt) 
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned offset) 
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned offset) 
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+copy_file_range (int fd_in, int fd_out, unsigned length) 
+{
+  return syscall3 (SYS_COPY_FILE_RANGE, fd_in, fd_out, length);
+}
+
+bool
+pipe (int fds[2]) 
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+int
+futex_wait (int *addr, int expected) 
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, expected);
+}
+
+int
+futex_wake (int *addr, int count) 
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, count);
+}
+
+/* Entry point of threads started by thread_spawn(): runs
+   FUNC (AUX), then ends the thread. */
+static void
+thread_start (void (*func) (void *), void *aux) 
+{
+  func (aux);
+  thread_exit (0);
+}
+
+pid_t
+thread_spawn (void (*func) (void *), void *aux) 
+{
+  return syscall3 (SYS_THREAD_SPAWN, thread_start, func, aux);
+}
+
+int
+thread_join (pid_t tid) 
+{
+  return syscall1 (SYS_THREAD_JOIN, tid);
+}
+
+void
+thread_exit (int status) 
+{
+  syscall1 (SYS_THREAD_EXIT, status);
+  NOT_REACHED ();
+}
+
+int
+shm_create (unsigned size) 
+{
+  return syscall1 (SYS_SHM_CREATE, size);
+}
+
+void *
+shm_attach (int id, void *addr) 
+{
+  return (void *) syscall2 (SYS_SHM_ATTACH, id, addr);
+}
+
+bool
+shm_detach (void *addr) 
+{
+  return syscall1 (SYS_SHM_DETACH, addr);
+}
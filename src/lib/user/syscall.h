@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <uio.h>
+
+struct syscall_ring;
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +48,21 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int ring_enter (struct syscall_ring *, unsigned to_submit);
+int readv (int fd, const struct iovec *, int iovcnt);
+int writev (int fd, const struct iovec *, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, unsigned offset);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned offset);
+int copy_file_range (int fd_in, int fd_out, unsigned length);
+bool pipe (int fds[2]);
+int futex_wait (int *addr, int expected);
+int futex_wake (int *addr, int count);
+pid_t thread_spawn (void (*func) (void *), void *aux);
+int thread_join (pid_t);
+void thread_exit (int status) NO_RETURN;
+int shm_create (unsigned size);
+void *shm_attach (int id, void *addr);
+bool shm_detach (void *addr);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,24 @@
+/* Tries directory operations that must fail, and checks that
+   they do not disturb the file system. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/f", 0), "create \"a/f\"");
+  CHECK (!mkdir ("a"), "mkdir \"a\" again (must fail)");
+  CHECK (!mkdir (""), "mkdir \"\" (must fail)");
+  CHECK (!create ("a/f/g", 0), "create \"a/f/g\" (must fail)");
+  CHECK (!create ("none/g", 0), "create \"none/g\" (must fail)");
+  CHECK (!create ("a/..", 0), "create \"a/..\" (must fail)");
+  CHECK (!chdir ("a/f"), "chdir \"a/f\" (must fail)");
+  CHECK (!chdir ("none"), "chdir \"none\" (must fail)");
+  CHECK (open ("a/f/..") == -1, "open \"a/f/..\" (must fail)");
+  CHECK (!remove ("a"), "remove non-empty \"a\" (must fail)");
+  CHECK (!remove ("/"), "remove \"/\" (must fail)");
+  CHECK (open ("a/f") > 1, "open \"a/f\"");
+}
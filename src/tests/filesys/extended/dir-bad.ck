@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(dir-bad) begin
+(dir-bad) mkdir "a"
+(dir-bad) create "a/f"
+(dir-bad) mkdir "a" again (must fail)
+(dir-bad) mkdir "" (must fail)
+(dir-bad) create "a/f/g" (must fail)
+(dir-bad) create "none/g" (must fail)
+(dir-bad) create "a/.." (must fail)
+(dir-bad) chdir "a/f" (must fail)
+(dir-bad) chdir "none" (must fail)
+(dir-bad) open "a/f/.." (must fail)
+(dir-bad) remove non-empty "a" (must fail)
+(dir-bad) remove "/" (must fail)
+(dir-bad) open "a/f"
+(dir-bad) end
+dir-bad: exit(0)
+EOF
+pass;
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my (%big) = map (("file$_" => ['']), grep ($_ % 2, 0...399));
+check_archive ({'big' => \%big});
+pass;
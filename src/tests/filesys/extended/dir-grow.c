@@ -0,0 +1,70 @@
+/* Creates enough files in one directory that it has to grow
+   well past the room it is created with, checks that every one
+   of them can be found, opened, and listed, then removes half of
+   them and checks again. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 400
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  int fd, cnt, i;
+
+  CHECK (mkdir ("big"), "mkdir \"big\"");
+  CHECK (chdir ("big"), "chdir \"big\"");
+
+  msg ("creating %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  msg ("opening %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\"", name);
+      close (fd);
+    }
+
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  for (cnt = 0; readdir (fd, name); cnt++)
+    continue;
+  close (fd);
+  CHECK (cnt == FILE_CNT, "readdir returned %d entries", FILE_CNT);
+
+  msg ("removing every even-numbered file");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+
+  msg ("checking every file");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      fd = open (name);
+      if ((fd > 1) != (i % 2 != 0))
+        fail ("open \"%s\" %s", name, fd > 1 ? "succeeded" : "failed");
+      if (fd > 1)
+        close (fd);
+    }
+
+  CHECK ((fd = open (".")) > 1, "open \".\"");
+  for (cnt = 0; readdir (fd, name); cnt++)
+    continue;
+  close (fd);
+  CHECK (cnt == FILE_CNT / 2, "readdir returned %d entries", FILE_CNT / 2);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(dir-grow) begin
+(dir-grow) mkdir "big"
+(dir-grow) chdir "big"
+(dir-grow) creating 400 files
+(dir-grow) opening 400 files
+(dir-grow) open "."
+(dir-grow) readdir returned 400 entries
+(dir-grow) removing every even-numbered file
+(dir-grow) checking every file
+(dir-grow) open "."
+(dir-grow) readdir returned 200 entries
+(dir-grow) end
+dir-grow: exit(0)
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Tests readdir(), isdir(), and inumber() on a directory that
+   holds both files and a subdirectory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static const char *names[] = {"f1", "f2", "sub"};
+  bool found[3] = {false, false, false};
+  char name[READDIR_MAX_LEN + 1];
+  int dir_fd, file_fd, sub_fd;
+  size_t i;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/f1", 0), "create \"d/f1\"");
+  CHECK (create ("d/f2", 0), "create \"d/f2\"");
+  CHECK (mkdir ("d/sub"), "mkdir \"d/sub\"");
+
+  CHECK ((dir_fd = open ("d")) > 1, "open \"d\"");
+  CHECK (isdir (dir_fd), "isdir \"d\"");
+  CHECK ((file_fd = open ("d/f1")) > 1, "open \"d/f1\"");
+  CHECK (!isdir (file_fd), "!isdir \"d/f1\"");
+  CHECK (inumber (file_fd) != inumber (dir_fd),
+         "inumber \"d/f1\" differs from inumber \"d\"");
+  CHECK ((sub_fd = open ("d/sub/..")) > 1, "open \"d/sub/..\"");
+  CHECK (inumber (sub_fd) == inumber (dir_fd),
+         "inumber \"d/sub/..\" equals inumber \"d\"");
+
+  msg ("readdir \"d\"");
+  while (readdir (dir_fd, name))
+    {
+      for (i = 0; i < 3; i++)
+        if (!strcmp (name, names[i]))
+          break;
+      if (i >= 3)
+        fail ("readdir returned unexpected entry \"%s\"", name);
+      if (found[i])
+        fail ("readdir returned \"%s\" twice", name);
+      found[i] = true;
+    }
+  for (i = 0; i < 3; i++)
+    if (!found[i])
+      fail ("readdir did not return \"%s\"", names[i]);
+  CHECK (!readdir (file_fd, name), "readdir \"d/f1\" (must fail)");
+}
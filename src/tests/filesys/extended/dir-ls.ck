@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(dir-ls) begin
+(dir-ls) mkdir "d"
+(dir-ls) create "d/f1"
+(dir-ls) create "d/f2"
+(dir-ls) mkdir "d/sub"
+(dir-ls) open "d"
+(dir-ls) isdir "d"
+(dir-ls) open "d/f1"
+(dir-ls) !isdir "d/f1"
+(dir-ls) inumber "d/f1" differs from inumber "d"
+(dir-ls) open "d/sub/.."
+(dir-ls) inumber "d/sub/.." equals inumber "d"
+(dir-ls) readdir "d"
+(dir-ls) readdir "d/f1" (must fail)
+(dir-ls) end
+dir-ls: exit(0)
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Tests relative paths, including "." and "..", and changing
+   the working directory with them. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int fd, root_fd;
+
+  CHECK (mkdir ("/x"), "mkdir \"/x\"");
+  CHECK (mkdir ("/x/y"), "mkdir \"/x/y\"");
+  CHECK (chdir ("/x/y"), "chdir \"/x/y\"");
+  CHECK (create ("../f", 0), "create \"../f\"");
+  CHECK (mkdir ("../../z"), "mkdir \"../../z\"");
+  CHECK (chdir ("../.."), "chdir \"../..\"");
+  CHECK ((fd = open ("x/./y/../f")) > 1, "open \"x/./y/../f\"");
+  msg ("close \"x/./y/../f\"");
+  close (fd);
+  CHECK (chdir ("z"), "chdir \"z\"");
+  CHECK (!chdir ("../x/f"), "chdir \"../x/f\" (must fail)");
+  CHECK ((fd = open ("..")) > 1, "open \"..\"");
+  CHECK ((root_fd = open ("/")) > 1, "open \"/\"");
+  CHECK (inumber (fd) == inumber (root_fd),
+         "inumber \"..\" equals inumber \"/\"");
+  CHECK ((fd = open ("/..")) > 1, "open \"/..\"");
+  CHECK (inumber (fd) == inumber (root_fd),
+         "inumber \"/..\" equals inumber \"/\"");
+}
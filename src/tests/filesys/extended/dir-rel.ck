@@ -0,0 +1,25 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(dir-rel) begin
+(dir-rel) mkdir "/x"
+(dir-rel) mkdir "/x/y"
+(dir-rel) chdir "/x/y"
+(dir-rel) create "../f"
+(dir-rel) mkdir "../../z"
+(dir-rel) chdir "../.."
+(dir-rel) open "x/./y/../f"
+(dir-rel) close "x/./y/../f"
+(dir-rel) chdir "z"
+(dir-rel) chdir "../x/f" (must fail)
+(dir-rel) open ".."
+(dir-rel) open "/"
+(dir-rel) inumber ".." equals inumber "/"
+(dir-rel) open "/.."
+(dir-rel) inumber "/.." equals inumber "/"
+(dir-rel) end
+dir-rel: exit(0)
+EOF
+pass;
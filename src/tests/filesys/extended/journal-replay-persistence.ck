@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+
+# If the test run left anything in the log, this run must have
+# replayed it.
+my ($logged) = 0;
+foreach (read_text_file ("tests/filesys/extended/journal-replay.output")) {
+    $logged = $1 if /^journal: stopping with (\d+) sectors in the log$/;
+}
+if ($logged > 0) {
+    fail "journal was not replayed\n"
+      if !grep (/^journal: replaying $logged sectors$/,
+		read_text_file ("$test.output"));
+}
+
+my (%fs);
+for my $d (0...7) {
+    $fs{"j$d"} = {map (("f$_" => ["j$d/f$_"]), grep ($_ % 2, 0...19))};
+}
+check_archive (\%fs);
+pass;
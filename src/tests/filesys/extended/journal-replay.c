@@ -0,0 +1,52 @@
+/* Makes enough metadata changes that the journal is checkpointed
+   several times along the way.  The kernel runs with
+   -nocheckpoint, so it powers off with the last changes still
+   in the log, and the persistence check only passes if they are
+   replayed when the file system is next mounted. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DIR_CNT 8
+#define FILE_CNT 20
+
+void
+test_main (void) 
+{
+  char name[32];
+  int d, f, fd;
+
+  msg ("creating %d directories of %d files", DIR_CNT, FILE_CNT);
+  for (d = 0; d < DIR_CNT; d++)
+    {
+      snprintf (name, sizeof name, "j%d", d);
+      if (!mkdir (name))
+        fail ("mkdir \"%s\"", name);
+      for (f = 0; f < FILE_CNT; f++)
+        {
+          int len;
+
+          len = snprintf (name, sizeof name, "j%d/f%d", d, f);
+          if (!create (name, 0))
+            fail ("create \"%s\"", name);
+          fd = open (name);
+          if (fd < 2)
+            fail ("open \"%s\"", name);
+          if (write (fd, name, len) != len)
+            fail ("write \"%s\"", name);
+          close (fd);
+        }
+    }
+
+  msg ("removing even-numbered files");
+  for (d = 0; d < DIR_CNT; d++)
+    for (f = 0; f < FILE_CNT; f += 2)
+      {
+        snprintf (name, sizeof name, "j%d/f%d", d, f);
+        if (!remove (name))
+          fail ("remove \"%s\"", name);
+      }
+}
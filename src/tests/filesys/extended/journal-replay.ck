@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+my (@output) = read_text_file ("$test.output");
+fail "journal was never checkpointed\n"
+  if !grep (/^journal: .* [1-9]\d* checkpoints$/, @output);
+fail "journal was checkpointed at power off\n"
+  if !grep (/^journal: stopping with \d+ sectors in the log$/, @output);
+check_expected ([<<'EOF']);
+(journal-replay) begin
+(journal-replay) creating 8 directories of 20 files
+(journal-replay) removing even-numbered files
+(journal-replay) end
+journal-replay: exit(0)
+EOF
+pass;
@@ -0,0 +1,43 @@
+/* Copies "sample.txt" to a new file with one copy_file_range()
+   call and verifies the copy.  Also checks that copies within a
+   single file are refused when the ranges overlap. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int in_fd, out_fd, dup_fd;
+
+  CHECK ((in_fd = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (create ("copy.txt", 0), "create \"copy.txt\"");
+  CHECK ((out_fd = open ("copy.txt")) > 1, "open \"copy.txt\"");
+
+  CHECK (copy_file_range (in_fd, out_fd, 65536) == sizeof sample - 1,
+         "copy_file_range \"sample.txt\" to \"copy.txt\"");
+  CHECK (tell (in_fd) == sizeof sample - 1
+         && tell (out_fd) == sizeof sample - 1, "tell after copy");
+  CHECK (copy_file_range (in_fd, out_fd, 65536) == 0,
+         "copy_file_range at end of file");
+
+  seek (out_fd, 0);
+  CHECK (copy_file_range (out_fd, out_fd, 16) == -1,
+         "copy_file_range from \"copy.txt\" to itself");
+  CHECK ((dup_fd = open ("copy.txt")) > 1, "open \"copy.txt\" again");
+  seek (dup_fd, 8);
+  CHECK (copy_file_range (out_fd, dup_fd, 16) == -1,
+         "copy_file_range between overlapping ranges of \"copy.txt\"");
+  msg ("close \"copy.txt\" again");
+  close (dup_fd);
+  seek (out_fd, sizeof sample - 1);
+
+  msg ("close \"sample.txt\"");
+  close (in_fd);
+  msg ("close \"copy.txt\"");
+  close (out_fd);
+
+  check_file ("copy.txt", sample, sizeof sample - 1);
+}
@@ -0,0 +1,20 @@
+/* Checks that futex_wait returns at once when the futex word
+   does not hold the expected value, and that futex_wake on a
+   word nobody sleeps on wakes nobody. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int word = 1;
+
+void
+test_main (void) 
+{
+  int local = 5;
+
+  CHECK (futex_wait (&word, 0) == -1, "futex_wait on changed word");
+  CHECK (futex_wake (&word, 1) == 0, "futex_wake with no waiters");
+  CHECK (futex_wait (&local, 4) == -1, "futex_wait on stack word");
+  CHECK (futex_wake (&local, 10) == 0, "futex_wake on stack word");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-nowait) begin
+(futex-nowait) futex_wait on changed word
+(futex-nowait) futex_wake with no waiters
+(futex-nowait) futex_wait on stack word
+(futex-nowait) futex_wake on stack word
+(futex-nowait) end
+futex-nowait: exit(0)
+EOF
+pass;
@@ -0,0 +1,44 @@
+/* Has a thread sleep on a futex, makes sure that it is asleep,
+   and checks that futex_wake wakes it and that it resumes.
+   thread_spawn does not run the new thread right away, so the
+   main thread first waits for the waiter to say that it is
+   about to sleep, and then retries the wake until it finds the
+   waiter sleeping. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int ready;
+static int word;
+
+static void
+waiter (void *aux UNUSED) 
+{
+  ready = 1;
+  futex_wake (&ready, 1);
+  thread_exit (futex_wait (&word, 0) == 0 ? 42 : -42);
+}
+
+void
+test_main (void) 
+{
+  pid_t tid;
+  int woken;
+
+  /* Touch both words, so that they are mapped. */
+  ready = word = 0;
+
+  CHECK ((tid = thread_spawn (waiter, NULL)) != -1, "spawn waiter");
+  while (ready == 0)
+    futex_wait (&ready, 0);
+  msg ("waiter is ready");
+
+  /* The waiter sleeps on WORD, which stays 0, until it is
+     woken, so a wake that finds nobody just has to be
+     retried. */
+  while ((woken = futex_wake (&word, 1)) == 0)
+    continue;
+  CHECK (woken == 1, "futex_wake woke the waiter");
+  CHECK (thread_join (tid) == 42, "waiter resumed from futex_wait");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wake) begin
+(futex-wake) spawn waiter
+(futex-wake) waiter is ready
+(futex-wake) futex_wake woke the waiter
+(futex-wake) waiter resumed from futex_wait
+(futex-wake) end
+futex-wake: exit(0)
+EOF
+pass;
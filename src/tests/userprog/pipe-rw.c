@@ -0,0 +1,34 @@
+/* Writes to a pipe, reads the data back from the other end, and
+   checks that reads see end of file once the write end is
+   closed. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static const char data[] = "through the pipe";
+  char buffer[sizeof data];
+  int fds[2];
+
+  CHECK (pipe (fds), "pipe");
+  CHECK (fds[0] > 1 && fds[1] > 1 && fds[0] != fds[1],
+         "pipe returned two new fds");
+
+  CHECK (write (fds[1], data, sizeof data) == sizeof data, "write pipe");
+  CHECK (read (fds[0], buffer, sizeof buffer) == sizeof data, "read pipe");
+  if (memcmp (buffer, data, sizeof data))
+    fail ("data read from pipe differs");
+
+  CHECK (write (fds[0], data, sizeof data) == -1, "write read end");
+  CHECK (read (fds[1], buffer, sizeof buffer) == -1, "read write end");
+
+  msg ("close write end");
+  close (fds[1]);
+  CHECK (read (fds[0], buffer, sizeof buffer) == 0, "read end of file");
+  msg ("close read end");
+  close (fds[0]);
+}
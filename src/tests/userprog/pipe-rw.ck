@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-rw) begin
+(pipe-rw) pipe
+(pipe-rw) pipe returned two new fds
+(pipe-rw) write pipe
+(pipe-rw) read pipe
+(pipe-rw) write read end
+(pipe-rw) read write end
+(pipe-rw) close write end
+(pipe-rw) read end of file
+(pipe-rw) close read end
+(pipe-rw) end
+pipe-rw: exit(0)
+EOF
+pass;
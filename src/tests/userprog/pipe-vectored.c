@@ -0,0 +1,31 @@
+/* Writes to a pipe with writev, including with buffers that are
+   all empty, and reads the data back with readv spread across
+   several buffers. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static char first[] = "through ";
+  static char second[] = "the pipe";
+  char a[4], b[6], c[16];
+  struct iovec empty[2] = {{first, 0}, {second, 0}};
+  struct iovec out[2] = {{first, 8}, {second, 8}};
+  struct iovec in[4] = {{a, 0}, {a, sizeof a}, {b, sizeof b}, {c, sizeof c}};
+  int fds[2];
+
+  CHECK (pipe (fds), "pipe");
+  CHECK (writev (fds[1], empty, 2) == 0, "writev empty buffers");
+  CHECK (writev (fds[1], out, 2) == 16, "writev pipe");
+  CHECK (readv (fds[0], in, 4) == 16, "readv pipe");
+  if (memcmp (a, "thro", 4) || memcmp (b, "ugh th", 6)
+      || memcmp (c, "e pipe", 6))
+    fail ("data read from pipe differs");
+  msg ("close write end");
+  close (fds[1]);
+  CHECK (readv (fds[0], in, 4) == 0, "readv end of file");
+}
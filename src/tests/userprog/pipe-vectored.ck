@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-vectored) begin
+(pipe-vectored) pipe
+(pipe-vectored) writev empty buffers
+(pipe-vectored) writev pipe
+(pipe-vectored) readv pipe
+(pipe-vectored) close write end
+(pipe-vectored) readv end of file
+(pipe-vectored) end
+pipe-vectored: exit(0)
+EOF
+pass;
@@ -0,0 +1,62 @@
+/* Runs open, write, seek, read, and close on "sample.txt"
+   through a syscall ring and checks every completion, along with
+   a call that may not be queued. */
+
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include <syscall-ring.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct syscall_ring ring;
+
+/* Removes the next completion from the ring, checks that it is
+   for the call tagged USER_DATA, and returns its result. */
+static int
+pop (const char *name, uint32_t user_data)
+{
+  struct ring_cqe cqe;
+
+  if (!ring_pop (&ring, &cqe))
+    fail ("no completion for %s", name);
+  if (cqe.user_data != user_data)
+    fail ("completion for %s has user_data %u, not %u",
+          name, (unsigned) cqe.user_data, (unsigned) user_data);
+  return cqe.result;
+}
+
+void
+test_main (void) 
+{
+  static char buf[sizeof sample];
+  struct ring_cqe cqe;
+  int fd;
+
+  ring_init (&ring);
+  ring_push (&ring, SYS_OPEN, (uint32_t) "sample.txt", 0, 0, 1);
+  ring_push (&ring, SYS_REMOVE, (uint32_t) "sample.txt", 0, 0, 2);
+  CHECK (ring_enter (&ring, 2) == 2, "ring_enter open, remove");
+  CHECK ((fd = pop ("open", 1)) > 1, "open \"sample.txt\" through ring");
+  CHECK (pop ("remove", 2) == -1, "remove through ring fails");
+
+  ring_push (&ring, SYS_WRITE, fd, (uint32_t) "Ring", 4, 3);
+  ring_push (&ring, SYS_SEEK, fd, 0, 0, 4);
+  ring_push (&ring, SYS_READ, fd, (uint32_t) buf, sizeof sample - 1, 5);
+  ring_push (&ring, SYS_CLOSE, fd, 0, 0, 6);
+  CHECK (ring_enter (&ring, 4) == 4, "ring_enter write, seek, read, close");
+  CHECK (pop ("write", 3) == 4, "write through ring");
+  CHECK (pop ("seek", 4) == 0, "seek through ring");
+  CHECK (pop ("read", 5) == (int) sizeof sample - 1, "read through ring");
+  CHECK (pop ("close", 6) == 0, "close through ring");
+  CHECK (!ring_pop (&ring, &cqe), "no more completions");
+
+  if (memcmp (buf, "Ring", 4)
+      || memcmp (buf + 4, sample + 4, sizeof sample - 5))
+    fail ("read through ring returned wrong data");
+  msg ("verified data read through ring");
+
+  CHECK ((fd = open ("sample.txt")) > 1, "open \"sample.txt\" after ring");
+  close (fd);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ring-batch) begin
+(ring-batch) ring_enter open, remove
+(ring-batch) open "sample.txt" through ring
+(ring-batch) remove through ring fails
+(ring-batch) ring_enter write, seek, read, close
+(ring-batch) write through ring
+(ring-batch) seek through ring
+(ring-batch) read through ring
+(ring-batch) close through ring
+(ring-batch) no more completions
+(ring-batch) verified data read through ring
+(ring-batch) open "sample.txt" after ring
+(ring-batch) end
+ring-batch: exit(0)
+EOF
+pass;
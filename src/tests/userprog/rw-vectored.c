@@ -0,0 +1,56 @@
+/* Writes a header and a body with one writev(), reads the body
+   back with pread(), overwrites the header with pwrite(), and
+   reads both back with one readv(), checking that the positional
+   calls leave the file position alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HEADER_LEN 7
+
+void
+test_main (void) 
+{
+  static char header[HEADER_LEN + 1] = "header:";
+  static char buffer[sizeof sample];
+  static char header2[HEADER_LEN];
+  int total = HEADER_LEN + sizeof sample - 1;
+  struct iovec iov[2];
+  int fd;
+
+  CHECK (create ("vec.txt", 0), "create \"vec.txt\"");
+  CHECK ((fd = open ("vec.txt")) > 1, "open \"vec.txt\"");
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = HEADER_LEN;
+  iov[1].iov_base = sample;
+  iov[1].iov_len = sizeof sample - 1;
+  CHECK (writev (fd, iov, 2) == total, "writev header and body");
+  CHECK ((int) tell (fd) == total, "tell after writev");
+
+  CHECK (pread (fd, buffer, sizeof sample - 1, HEADER_LEN)
+         == (int) sizeof sample - 1, "pread body");
+  if (memcmp (buffer, sample, sizeof sample - 1))
+    fail ("pread body differs");
+
+  memcpy (header, "HEADER:", HEADER_LEN);
+  CHECK (pwrite (fd, header, HEADER_LEN, 0) == HEADER_LEN,
+         "pwrite header");
+  CHECK ((int) tell (fd) == total, "tell after pread and pwrite");
+
+  memset (buffer, 0, sizeof buffer);
+  iov[0].iov_base = header2;
+  iov[1].iov_base = buffer;
+  seek (fd, 0);
+  CHECK (readv (fd, iov, 2) == total, "readv header and body");
+  if (memcmp (header2, "HEADER:", HEADER_LEN))
+    fail ("readv header differs");
+  if (memcmp (buffer, sample, sizeof sample - 1))
+    fail ("readv body differs");
+
+  msg ("close \"vec.txt\"");
+  close (fd);
+}
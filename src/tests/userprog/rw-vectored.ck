@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rw-vectored) begin
+(rw-vectored) create "vec.txt"
+(rw-vectored) open "vec.txt"
+(rw-vectored) writev header and body
+(rw-vectored) tell after writev
+(rw-vectored) pread body
+(rw-vectored) pwrite header
+(rw-vectored) tell after pread and pwrite
+(rw-vectored) readv header and body
+(rw-vectored) close "vec.txt"
+(rw-vectored) end
+rw-vectored: exit(0)
+EOF
+pass;
@@ -0,0 +1,58 @@
+/* Spawns threads that share the process's memory, joins them,
+   and checks their exit statuses and the values they stored.
+   Then has a thread wait on a futex for a flag that the main
+   thread sets.  The thread may not get to sleep before the flag
+   is set; futex-wake checks the case where it does. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+
+static int squares[THREAD_CNT];
+static int flag;
+
+static void
+square (void *aux) 
+{
+  int i = (int) aux;
+
+  squares[i] = i * i;
+  thread_exit (i + 10);
+}
+
+static void
+sleeper (void *aux UNUSED) 
+{
+  while (flag == 0)
+    futex_wait (&flag, 0);
+  thread_exit (flag);
+}
+
+void
+test_main (void) 
+{
+  pid_t tids[THREAD_CNT];
+  pid_t tid;
+  int i;
+
+  msg ("spawn %d threads", THREAD_CNT);
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      tids[i] = thread_spawn (square, (void *) i);
+      if (tids[i] == -1)
+        fail ("thread_spawn returned -1");
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (thread_join (tids[i]) == i + 10, "join thread %d", i);
+  for (i = 0; i < THREAD_CNT; i++)
+    if (squares[i] != i * i)
+      fail ("thread %d stored %d, not %d", i, squares[i], i * i);
+  CHECK (thread_join (tids[0]) == -1, "join thread 0 again");
+
+  CHECK ((tid = thread_spawn (sleeper, NULL)) != -1, "spawn sleeper");
+  flag = 1;
+  futex_wake (&flag, 1);
+  CHECK (thread_join (tid) == 1, "join sleeper");
+}
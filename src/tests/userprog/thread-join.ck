@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-join) begin
+(thread-join) spawn 4 threads
+(thread-join) join thread 0
+(thread-join) join thread 1
+(thread-join) join thread 2
+(thread-join) join thread 3
+(thread-join) join thread 0 again
+(thread-join) spawn sleeper
+(thread-join) join sleeper
+(thread-join) end
+thread-join: exit(0)
+EOF
+pass;
@@ -0,0 +1,45 @@
+/* Child process for shm-share test.
+   Given a segment id, attaches the segment, checks the parent's
+   message in its first page, and writes a reply to its second
+   page.  Given "new", creates a large segment, writes to every
+   page of it, and exits with its id, without detaching it. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "child-shm";
+
+#define CHILD_ADDR ((char *) 0x40000000)
+
+/* Size of a new segment, in pages. */
+#define NEW_PAGES 128
+
+int
+main (int argc UNUSED, char *argv[]) 
+{
+  char *p;
+  int id;
+
+  quiet = true;
+
+  if (!strcmp (argv[1], "new"))
+    {
+      size_t i;
+
+      CHECK ((id = shm_create (NEW_PAGES * 4096)) > 0, "create segment");
+      CHECK ((p = shm_attach (id, CHILD_ADDR)) == CHILD_ADDR,
+             "attach segment");
+      for (i = 0; i < NEW_PAGES; i++)
+        p[i * 4096] = i;
+      return id;
+    }
+
+  id = atoi (argv[1]);
+  CHECK ((p = shm_attach (id, CHILD_ADDR)) == CHILD_ADDR, "attach segment");
+  CHECK (!strcmp (p, "hello from parent"), "read parent's message");
+  strlcpy (p + 4096, "hello from child", 4096);
+  CHECK (shm_detach (p), "detach segment");
+  return 0;
+}
@@ -0,0 +1,57 @@
+/* Shares a segment with a child process and checks that each
+   sees what the other wrote, that detaching and reattaching
+   keeps the segment's contents, and that a segment is freed once
+   its last reference is gone, by creating many large segments in
+   turn in child processes. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PARENT_ADDR ((char *) 0x30000000)
+
+/* Number of segments to create in children. */
+#define CHILD_CNT 32
+
+void
+test_main (void)
+{
+  char cmd[32];
+  pid_t child;
+  char *p;
+  int id, i;
+
+  CHECK ((id = shm_create (2 * 4096)) > 0, "create segment");
+  CHECK ((p = shm_attach (id, PARENT_ADDR)) == PARENT_ADDR,
+         "attach segment");
+  strlcpy (p, "hello from parent", 4096);
+
+  snprintf (cmd, sizeof cmd, "child-shm %d", id);
+  CHECK ((child = exec (cmd)) != -1, "exec child-shm");
+  quiet = true;
+  CHECK (wait (child) == 0, "wait for child");
+  quiet = false;
+  CHECK (!strcmp (p + 4096, "hello from child"), "read child's reply");
+
+  CHECK (shm_detach (p), "detach segment");
+  CHECK (!shm_detach (p), "detach segment again (must fail)");
+  CHECK (shm_attach (id, PARENT_ADDR) == PARENT_ADDR, "reattach segment");
+  CHECK (!strcmp (p, "hello from parent"), "segment kept its contents");
+  CHECK (shm_detach (p), "detach segment");
+
+  /* Each child's segment takes a good part of the user pool, so
+     if a segment's frames were not freed once the child that
+     created it exited, the children would soon run out. */
+  msg ("create segments in %d children", CHILD_CNT);
+  quiet = true;
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      CHECK ((child = exec ("child-shm new")) != -1, "exec child-shm new");
+      CHECK ((id = wait (child)) > 0, "wait for child");
+      if (shm_attach (id, PARENT_ADDR) != NULL)
+        fail ("segment %d outlived its last reference", id);
+    }
+  quiet = false;
+}
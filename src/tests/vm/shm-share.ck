@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($children) = join ('', map ("child-shm: exit($_)\n", 2 .. 33));
+check_expected ([<<EOF]);
+(shm-share) begin
+(shm-share) create segment
+(shm-share) attach segment
+(shm-share) exec child-shm
+child-shm: exit(0)
+(shm-share) read child's reply
+(shm-share) detach segment
+(shm-share) detach segment again (must fail)
+(shm-share) reattach segment
+(shm-share) segment kept its contents
+(shm-share) detach segment
+(shm-share) create segments in 32 children
+${children}(shm-share) end
+shm-share: exit(0)
+EOF
+pass;
@@ -25,7 +25,9 @@
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
+#include "userprog/pipe.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #else
@@ -34,8 +36,14 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/shm.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -52,6 +60,9 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -ramdisk: Size of RAM disk to create, in kB. */
+static size_t ramdisk_kb;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -113,6 +124,11 @@ main (void)
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  futex_init ();
+  pipe_init ();
+#endif
+#ifdef VM
+  shm_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
@@ -123,6 +139,8 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  ramdisk_init (ramdisk_kb);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -247,6 +265,10 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-nocheckpoint"))
+        journal_no_checkpoint = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -373,6 +395,8 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Create a KB kB RAM disk named ram0.\n"
+          "  -nocheckpoint      Leave the journal unflushed at power off.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
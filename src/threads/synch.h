@@ -41,6 +41,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the fields below. */
+    struct condition readers_ok;        /* Signaled when readers may enter. */
+    struct condition writer_ok;         /* Signaled when a writer may enter. */
+    unsigned readers;           /* Number of threads reading. */
+    unsigned waiting_writers;   /* Number of threads waiting to write. */
+    struct thread *writer;      /* Thread writing, if any. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -276,12 +276,6 @@ thread_create (const char *name, int priority, thread_func *function,
   tid = t->tid = allocate_tid ();
 
 #ifdef USERPROG
-  /* Initialize open files count to 1 */
-  t->fd_count = 1;
-
-  /* Initialize open files list */
-  list_init(&t->files_opened);
-
   /* Add parent thread pointer to child */
   t->process_w.parent_t = thread_current();
 
@@ -685,6 +679,14 @@ init_thread (struct thread *t, const char *name, int priority)
   sema_init(&t->process_w.loaded_sema, 0);
   sema_init(&t->process_w.finished_sema, 0);
   list_init(&t->process_w.children_processes);
+  t->leader = t;
+  list_init (&t->user_threads);
+  lock_init (&t->threads_lock);
+  cond_init (&t->thread_exited);
+  lock_init (&t->fd_lock);
+#endif
+#ifdef VM
+  list_init (&t->shm_mappings);
 #endif
 
   list_init (&t->donations);
@@ -108,10 +108,12 @@ struct thread
 
 #ifdef USERPROG
 
-  	struct list files_opened;			/* List of open files */
+  	struct file_descriptor **fd_table;	/* Open files, indexed by fd */
+  	uint32_t *fd_used;					/* Bitmap of fds in use */
   	struct file *executable;			/* Executable file of the thread */
+  	struct dir *cwd;					/* Current working directory */
 
-  	int fd_count;						/* Total count of open files */
+  	int fd_table_size;					/* Number of fds fd_table holds */
 
 	/* Owned by userprog/process.c. */
 	uint32_t *pagedir;                  /* Page directory. */
@@ -123,6 +125,22 @@ struct thread
 	  struct list children_processes;       /* Children processes */
 	  int exit_status;
 	} process_w;						    /* Process wrapper of this thread */
+
+	/* Threads of a user process share the page directory and the fd table
+	  of its main thread, the leader, which keeps the members below. */
+	struct thread *leader;				/* Main thread of the process */
+	struct user_thread *uthread;		/* Join record, if not the leader */
+	struct list user_threads;			/* Join records of other threads */
+	struct lock threads_lock;			/* Guards user_threads and records */
+	struct condition thread_exited;		/* Signaled when a thread exits */
+	struct lock fd_lock;				/* Guards fd_table and fd_used */
+	bool exiting;						/* Process is terminating */
+#endif
+
+#ifdef FILESYS
+	/* Owned by filesys/journal.c. */
+	int journal_depth;					/* Nesting of journal operations */
+	size_t journal_room;				/* Sectors the operation may add */
 #endif
 
 #ifdef VM
@@ -130,6 +148,9 @@ struct thread
 	/* Supplemental Page Table */
 	struct supp_pt *spt;
 
+	/* Owned by vm/shm.c. */
+	struct list shm_mappings;			/* Shared memory segments held */
+
 #endif
 
   	int nice;
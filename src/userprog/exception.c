@@ -1,5 +1,7 @@
 #include "../userprog/exception.h"
+#include "../userprog/process.h"
 #include "../userprog/syscall.h"
+#include "../userprog/uaccess.h"
 #include <inttypes.h>
 #include <stdio.h>
 #include "../userprog/gdt.h"
@@ -89,7 +91,7 @@ kill (struct intr_frame *f)
       printf ("%s: dying due to interrupt %#04x (%s).\n",
               thread_name (), f->vec_no, intr_name (f->vec_no));
       intr_dump_frame (f);
-      thread_exit ();
+      process_terminate (EXIT_FAIL);
 
     case SEL_KCSEG:
       /* Kernel's code segment, which indicates a kernel bug.
@@ -176,18 +178,17 @@ page_fault (struct intr_frame *f)
   }
 #endif
 
-  thread_current ()->process_w.exit_status = EXIT_FAIL;
-  close_all_files();
+  /* A fault in copy_from_user() or copy_to_user() resumes at its
+     fixup, which reports the bytes left uncopied. */
+  if (!user && uaccess_fixup (f))
+    return;
 
   /*
-   * Page fault in the kernel merely sets the interupt frame eax to 0xffffffff
-   * and copies the old value into eip
+   * Any other page fault in the kernel comes from dereferencing a bad
+   * user pointer on behalf of the process, which kills it.
    */
-  if (!user) {
-    f->eip = (void *) f->eax;
-    f->eax = 0xffffffff;
+  if (!user)
     exit_fail();
-  }
 
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
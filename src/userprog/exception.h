@@ -6,10 +6,6 @@
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
-#define MAX_STACK_SIZE 0x800000
-#define STACK_BASE (PHYS_BASE - MAX_STACK_SIZE)
-#define IS_STACK_ACCESS(x) (((STACK_BASE) <= (x) && (x) < (PHYS_BASE)))
-
 void exception_init (void);
 void exception_print_stats (void);
 
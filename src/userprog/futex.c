@@ -0,0 +1,199 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "userprog/uaccess.h"
+
+/* Fast user-space mutexes.
+
+   A futex is just a 32-bit word in user memory.  User code
+   manipulates it with atomic instructions and only calls into
+   the kernel to sleep while the word holds some value, or to wake
+   sleepers after changing it.
+
+   Sleepers are kept in wait queues, created on demand, in a hash
+   table keyed by the kernel virtual address of the word.  The
+   kernel maps all of physical memory, so that identifies the
+   word's physical location: processes that share the page, under
+   whatever user address, find the same queue. */
+
+struct futex_queue
+  {
+    const void *key;            /* Kernel address of the word. */
+    struct condition waiting;   /* Sleeping threads. */
+    int waiter_cnt;             /* Sleeping or woken but not yet run. */
+    struct hash_elem elem;      /* Element in `queues'. */
+  };
+
+/* Wait queues with at least one waiter. */
+static struct hash queues;
+
+/* Guards `queues' and every queue in it.  Also makes checking the
+   futex word and going to sleep atomic with respect to wakers. */
+static struct lock futex_lock;
+
+static hash_hash_func queue_hash;
+static hash_less_func queue_less;
+static const void *get_key (const int *uaddr);
+static struct futex_queue *find_queue (const void *key);
+
+/* Initializes the futex module. */
+void
+futex_init (void)
+{
+  hash_init (&queues, queue_hash, queue_less, NULL);
+  lock_init (&futex_lock);
+}
+
+/* If the word at UADDR still holds EXPECTED, sleeps until woken
+   by futex_wakeup() and returns 0.  Otherwise, or if the process
+   is terminating, returns -1 at once.
+   Terminates the process if UADDR is not a valid, aligned user
+   address. */
+int
+futex_sleep (int *uaddr, int expected)
+{
+  struct futex_queue *q;
+  const void *key;
+  int value;
+
+  lock_acquire (&futex_lock);
+  key = get_key (uaddr);
+  if (key == NULL || copy_from_user (&value, uaddr, sizeof value) != 0)
+    {
+      lock_release (&futex_lock);
+      exit_fail ();
+    }
+  if (value != expected || process_killed ())
+    {
+      lock_release (&futex_lock);
+      return -1;
+    }
+
+  q = find_queue (key);
+  if (q == NULL)
+    {
+      q = malloc (sizeof *q);
+      if (q == NULL)
+        {
+          lock_release (&futex_lock);
+          return -1;
+        }
+      q->key = key;
+      cond_init (&q->waiting);
+      q->waiter_cnt = 0;
+      hash_insert (&queues, &q->elem);
+    }
+
+  q->waiter_cnt++;
+  cond_wait (&q->waiting, &futex_lock);
+  if (--q->waiter_cnt == 0)
+    {
+      hash_delete (&queues, &q->elem);
+      free (q);
+    }
+  lock_release (&futex_lock);
+  return 0;
+}
+
+/* Wakes up to CNT threads sleeping on the word at UADDR and
+   returns the number woken.  Terminates the process if UADDR is
+   not a valid, aligned user address. */
+int
+futex_wakeup (int *uaddr, int cnt)
+{
+  struct futex_queue *q;
+  const void *key;
+  int woken = 0;
+
+  lock_acquire (&futex_lock);
+  key = get_key (uaddr);
+  if (key == NULL)
+    {
+      lock_release (&futex_lock);
+      exit_fail ();
+    }
+
+  q = find_queue (key);
+  if (q != NULL)
+    while (woken < cnt && !list_empty (&q->waiting.waiters))
+      {
+        cond_signal (&q->waiting, &futex_lock);
+        woken++;
+      }
+  lock_release (&futex_lock);
+  return woken;
+}
+
+/* Wakes every sleeping thread, so that the threads of a
+   terminating process notice.  Threads of other processes see a
+   spurious wakeup, which futex users must cope with anyway, since
+   the word may change again before a woken thread runs. */
+void
+futex_wake_all (void)
+{
+  struct hash_iterator i;
+
+  lock_acquire (&futex_lock);
+  hash_first (&i, &queues);
+  while (hash_next (&i))
+    {
+      struct futex_queue *q = hash_entry (hash_cur (&i),
+                                          struct futex_queue, elem);
+      cond_broadcast (&q->waiting, &futex_lock);
+    }
+  lock_release (&futex_lock);
+}
+
+/* Returns the key for the futex word at UADDR, or a null pointer
+   if UADDR is misaligned or not mapped in the running process.
+   Touches the word first, so that a page that is not yet loaded
+   gets faulted in. */
+static const void *
+get_key (const int *uaddr)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  int value;
+
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0
+      || copy_from_user (&value, uaddr, sizeof value) != 0)
+    return NULL;
+  return pagedir_get_page (pd, uaddr);
+}
+
+/* Returns the wait queue for KEY, or a null pointer if nobody is
+   waiting there. */
+static struct futex_queue *
+find_queue (const void *key)
+{
+  struct futex_queue q;
+  struct hash_elem *e;
+
+  q.key = key;
+  e = hash_find (&queues, &q.elem);
+  return e != NULL ? hash_entry (e, struct futex_queue, elem) : NULL;
+}
+
+/* Returns a hash value for queue E. */
+static unsigned
+queue_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct futex_queue *q = hash_entry (e, struct futex_queue, elem);
+  return hash_bytes (&q->key, sizeof q->key);
+}
+
+/* Returns true if queue A precedes queue B. */
+static bool
+queue_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  const struct futex_queue *qa = hash_entry (a, struct futex_queue, elem);
+  const struct futex_queue *qb = hash_entry (b, struct futex_queue, elem);
+  return qa->key < qb->key;
+}
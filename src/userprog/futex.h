@@ -0,0 +1,11 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdbool.h>
+
+void futex_init (void);
+int futex_sleep (int *uaddr, int expected);
+int futex_wakeup (int *uaddr, int cnt);
+void futex_wake_all (void);
+
+#endif /* userprog/futex.h */
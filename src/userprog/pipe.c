@@ -0,0 +1,351 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <list.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+
+/* Anonymous pipes.
+
+   A pipe is a one-page ring buffer with counts of the open read
+   and write ends.  Readers block while it is empty and writers
+   while it is full, on condition variables, so nobody polls.
+
+   When a reader finds the pipe empty, it also posts its buffer
+   before blocking.  A writer that finds a posted buffer copies
+   straight into it, through the reader's page directory, instead
+   of into the ring, so the data is copied once instead of
+   twice.
+
+   Blocked readers and writers also give up when their process is
+   terminating, since the end that would wake them may belong to
+   the very process that is waiting for them to exit. */
+
+/* Size of a pipe's ring buffer. */
+#define PIPE_SIZE PGSIZE
+
+struct pipe
+  {
+    struct lock lock;           /* Guards all the members below. */
+    struct condition readable;  /* Signaled when data arrives. */
+    struct condition writable;  /* Signaled when space frees up. */
+    int readers, writers;       /* Number of open ends of each kind. */
+
+    /* Ring buffer.  HEAD and TAIL run freely; HEAD - TAIL bytes
+       are in the pipe, starting at TAIL % PIPE_SIZE. */
+    uint8_t *buffer;
+    size_t head, tail;
+
+    /* Buffer posted by a reader waiting on an empty pipe. */
+    struct thread *reader;      /* Waiting reader, or null. */
+    uint8_t *reader_buf;        /* Reader's user buffer. */
+    size_t reader_want;         /* Size of READER_BUF. */
+    size_t reader_got;          /* Bytes a writer put there. */
+
+    struct list_elem elem;      /* Element in `pipes'. */
+  };
+
+/* All pipes, so that pipe_wake_all() can find their waiters. */
+static struct list pipes;
+
+/* Guards `pipes'. */
+static struct lock pipes_lock;
+
+/* Initializes the pipe module. */
+void
+pipe_init (void) 
+{
+  list_init (&pipes);
+  lock_init (&pipes_lock);
+}
+
+/* Creates and returns a new pipe with one read end and one write
+   end open.  Returns a null pointer if memory is short. */
+struct pipe *
+pipe_create (void) 
+{
+  struct pipe *p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+  p->buffer = palloc_get_page (0);
+  if (p->buffer == NULL) 
+    {
+      free (p);
+      return NULL;
+    }
+
+  lock_init (&p->lock);
+  cond_init (&p->readable);
+  cond_init (&p->writable);
+  p->readers = p->writers = 1;
+  p->head = p->tail = 0;
+  p->reader = NULL;
+  p->reader_buf = NULL;
+  p->reader_want = p->reader_got = 0;
+
+  lock_acquire (&pipes_lock);
+  list_push_back (&pipes, &p->elem);
+  lock_release (&pipes_lock);
+  return p;
+}
+
+/* Records another open read end of P, or write end if WRITER is
+   true. */
+void
+pipe_dup (struct pipe *p, bool writer) 
+{
+  lock_acquire (&p->lock);
+  if (writer)
+    p->writers++;
+  else
+    p->readers++;
+  lock_release (&p->lock);
+}
+
+/* Closes a read end of P, or a write end if WRITER is true, and
+   frees P when no ends remain.  Closing the last write end makes
+   reads return end of file once the pipe drains; closing the
+   last read end makes writes fail. */
+void
+pipe_close (struct pipe *p, bool writer) 
+{
+  bool last;
+
+  lock_acquire (&p->lock);
+  if (writer)
+    p->writers--;
+  else
+    p->readers--;
+  ASSERT (p->readers >= 0 && p->writers >= 0);
+  cond_broadcast (&p->readable, &p->lock);
+  cond_broadcast (&p->writable, &p->lock);
+  last = p->readers == 0 && p->writers == 0;
+  lock_release (&p->lock);
+
+  if (last) 
+    {
+      lock_acquire (&pipes_lock);
+      list_remove (&p->elem);
+      lock_release (&pipes_lock);
+      palloc_free_page (p->buffer);
+      free (p);
+    }
+}
+
+/* Wakes every thread blocked on a pipe, so that the threads of a
+   terminating process notice.  Threads of other processes find
+   nothing changed and go back to sleep. */
+void
+pipe_wake_all (void) 
+{
+  struct list_elem *e;
+
+  lock_acquire (&pipes_lock);
+  for (e = list_begin (&pipes); e != list_end (&pipes); e = list_next (e)) 
+    {
+      struct pipe *p = list_entry (e, struct pipe, elem);
+
+      lock_acquire (&p->lock);
+      cond_broadcast (&p->readable, &p->lock);
+      cond_broadcast (&p->writable, &p->lock);
+      lock_release (&p->lock);
+    }
+  lock_release (&pipes_lock);
+}
+
+/* Copies SIZE bytes from SRC into user buffer UDST of thread T,
+   which need not be the running thread, through T's page
+   directory.  Returns the number of bytes copied, which is less
+   than SIZE only if part of UDST is not mapped. */
+static size_t
+copy_to_thread (struct thread *t, uint8_t *udst, const uint8_t *src,
+                size_t size) 
+{
+  size_t copied = 0;
+
+  while (copied < size) 
+    {
+      uint8_t *kpage = pagedir_get_page (t->pagedir, udst + copied);
+      size_t page_left = PGSIZE - pg_ofs (udst + copied);
+      size_t chunk = size - copied < page_left ? size - copied : page_left;
+
+      if (kpage == NULL)
+        break;
+      memcpy (kpage, src + copied, chunk);
+      copied += chunk;
+    }
+  return copied;
+}
+
+/* Copies up to SIZE bytes out of P's ring into BUFFER, in up to
+   two pieces, and wakes writers if that frees any space.  Returns
+   the number of bytes copied.  The caller must hold P's lock. */
+static size_t
+read_ring (struct pipe *p, uint8_t *buffer, size_t size) 
+{
+  size_t cnt, ofs, first;
+
+  cnt = p->head - p->tail;
+  if (cnt > size)
+    cnt = size;
+  ofs = p->tail % PIPE_SIZE;
+  first = cnt < PIPE_SIZE - ofs ? cnt : PIPE_SIZE - ofs;
+  memcpy (buffer, p->buffer + ofs, first);
+  memcpy (buffer + first, p->buffer, cnt - first);
+  p->tail += cnt;
+  if (cnt > 0)
+    cond_broadcast (&p->writable, &p->lock);
+  return cnt;
+}
+
+/* Reads up to SIZE bytes from P into BUFFER, which is in the
+   running process's memory.  Blocks until at least one byte is
+   available, every write end is closed, or the process is
+   terminating.  Returns the number of bytes read, which is 0 at
+   end of file. */
+int
+pipe_read (struct pipe *p, void *buffer_, size_t size) 
+{
+  uint8_t *buffer = buffer_;
+  size_t cnt;
+
+  if (size == 0)
+    return 0;
+
+  lock_acquire (&p->lock);
+  while (p->head == p->tail && p->writers > 0 && !process_killed ()) 
+    {
+      size_t got;
+
+      if (p->reader != NULL) 
+        {
+          /* Another reader has posted its buffer.  Wait our turn. */
+          cond_wait (&p->readable, &p->lock);
+          continue;
+        }
+
+      /* Post our buffer for a writer to fill directly. */
+      p->reader = thread_current ();
+      p->reader_buf = buffer;
+      p->reader_want = size;
+      p->reader_got = 0;
+      while (p->reader_got == 0 && p->head == p->tail && p->writers > 0
+             && !process_killed ())
+        cond_wait (&p->readable, &p->lock);
+      got = p->reader_got;
+      p->reader = NULL;
+      p->reader_buf = NULL;
+      cond_broadcast (&p->readable, &p->lock);
+      if (got > 0) 
+        {
+          cond_broadcast (&p->writable, &p->lock);
+          lock_release (&p->lock);
+          return got;
+        }
+    }
+
+  cnt = read_ring (p, buffer, size);
+  lock_release (&p->lock);
+
+  return cnt;
+}
+
+/* Reads from P into the IOVCNT buffers described by IOV, which
+   are in the running process's memory, in order.  Blocks like
+   pipe_read() until at least one byte is available, but fills
+   the buffers after the first one only with data that the pipe
+   already holds.  Returns the number of bytes read, which is 0 at
+   end of file. */
+int
+pipe_readv (struct pipe *p, const struct iovec *iov, int iovcnt) 
+{
+  int total;
+  int i;
+
+  /* Block for the first nonempty buffer. */
+  for (i = 0; i < iovcnt && iov[i].iov_len == 0; i++)
+    continue;
+  if (i >= iovcnt)
+    return 0;
+  total = pipe_read (p, iov[i].iov_base, iov[i].iov_len);
+  if ((size_t) total < iov[i].iov_len)
+    return total;
+
+  /* Take whatever else is already there. */
+  lock_acquire (&p->lock);
+  for (i++; i < iovcnt && p->head != p->tail; i++) 
+    {
+      size_t cnt = read_ring (p, iov[i].iov_base, iov[i].iov_len);
+      total += cnt;
+      if (cnt < iov[i].iov_len)
+        break;
+    }
+  lock_release (&p->lock);
+
+  return total;
+}
+
+/* Writes SIZE bytes from BUFFER, which is in the running
+   process's memory, to P, blocking while the pipe is full.
+   Returns the number of bytes written, which is less than SIZE
+   only if every read end is closed or the process is terminating,
+   or -1 if every read end was already closed. */
+int
+pipe_write (struct pipe *p, const void *buffer_, size_t size) 
+{
+  const uint8_t *buffer = buffer_;
+  size_t written = 0;
+
+  lock_acquire (&p->lock);
+  if (p->readers == 0) 
+    {
+      lock_release (&p->lock);
+      return -1;
+    }
+
+  while (written < size && p->readers > 0 && !process_killed ()) 
+    {
+      size_t left = size - written;
+      size_t space = PIPE_SIZE - (p->head - p->tail);
+
+      if (p->reader_buf != NULL && p->reader_got == 0 && p->head == p->tail)
+        {
+          /* Fast path: a reader is waiting on an empty pipe, so
+             copy straight into its buffer. */
+          size_t cnt = left < p->reader_want ? left : p->reader_want;
+          cnt = copy_to_thread (p->reader, p->reader_buf,
+                                buffer + written, cnt);
+          if (cnt > 0) 
+            {
+              p->reader_got = cnt;
+              written += cnt;
+              cond_broadcast (&p->readable, &p->lock);
+              continue;
+            }
+        }
+
+      if (space > 0) 
+        {
+          /* Copy into the ring, in up to two pieces. */
+          size_t cnt = left < space ? left : space;
+          size_t ofs = p->head % PIPE_SIZE;
+          size_t first = cnt < PIPE_SIZE - ofs ? cnt : PIPE_SIZE - ofs;
+
+          memcpy (p->buffer + ofs, buffer + written, first);
+          memcpy (p->buffer, buffer + written + first, cnt - first);
+          p->head += cnt;
+          written += cnt;
+          cond_broadcast (&p->readable, &p->lock);
+        }
+      else
+        cond_wait (&p->writable, &p->lock);
+    }
+  lock_release (&p->lock);
+
+  return written;
+}
@@ -0,0 +1,19 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <uio.h>
+
+struct pipe;
+
+void pipe_init (void);
+struct pipe *pipe_create (void);
+void pipe_dup (struct pipe *, bool writer);
+void pipe_close (struct pipe *, bool writer);
+int pipe_read (struct pipe *, void *, size_t size);
+int pipe_readv (struct pipe *, const struct iovec *, int iovcnt);
+int pipe_write (struct pipe *, const void *, size_t size);
+void pipe_wake_all (void);
+
+#endif /* userprog/pipe.h */
@@ -8,8 +8,10 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/pipe.h"
 #include "userprog/process.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
@@ -19,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "vm/page.h"
+#include "vm/shm.h"
 
 //#define DEBUG
 
@@ -35,11 +38,16 @@
 #endif
 
 static thread_func start_process NO_RETURN;
+static thread_func start_user_thread NO_RETURN;
 static bool load (const char *file_name, char *args, void (**eip) (void),
                   void **esp);
 static int push_arguments (void **esp, const char *file_name, char *args);
 static void update_child_status (struct thread *parent, pid_t child_pid,
                                  int status);
+static void release_children (struct thread *t);
+static void stop_user_threads (void);
+static void exit_user_thread (void);
+static void *stack_page (int slot);
 
 struct command_line
 {
@@ -68,11 +76,9 @@ tid_t process_execute (const char *file_name)
 	cmd_line.name = strtok_r (fn_copy, " ", &cmd_line.args);
 
   	/* Deny writes to executable while the process is still running */
-  	lock_acquire (&file_sys_lock);
   	thread_current()->executable = filesys_open (cmd_line.name);
   	if (thread_current()->executable)
     	file_deny_write (thread_current()->executable);
-  	lock_release (&file_sys_lock);
 
 	/* Create a new thread to execute FILE_NAME. */
 	tid = thread_create (cmd_line.name, PRI_DEFAULT, start_process, &cmd_line);
@@ -122,6 +128,14 @@ static void start_process (void *cmd_line_)
 	struct thread *cur = thread_current ();
 	struct thread *parent = cur->process_w.parent_t;
 
+	/* Inherit the working directory of the parent, which is waiting for us to
+	  finish loading */
+	if (parent->cwd != NULL)
+		cur->cwd = dir_reopen (parent->cwd);
+
+	/* Inherit the parent's pipe ends */
+	inherit_pipes (parent);
+
 	/* Initialize interrupt frame and load executable. */
 	memset (&if_, 0, sizeof if_);
 	if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
@@ -211,38 +225,45 @@ void process_exit (void)
   	struct thread *parent = cur->process_w.parent_t;
 	uint32_t *pd;
 
-	enum intr_level old_level = intr_disable ();
+	/* Threads other than the main one only give back their own resources */
+	if (cur->leader != cur)
+	{
+		exit_user_thread ();
+		return;
+	}
 
-	int exit_status = cur->process_w.exit_status;
+	/* Everything freed below is shared with the other threads, so they must
+	  be gone first */
+	stop_user_threads ();
+	close_all_files ();
 
-	/* Free children processes list when terminating */
-	struct process_wrapper *process_w = &cur->process_w;
-	struct list *children = &process_w->children_processes;
-	struct list_elem *e;
+	/* Release the working directory.  This may free its blocks, so do it
+	  before disabling interrupts */
+	dir_close (cur->cwd);
+	cur->cwd = NULL;
+
+#ifdef VM
+	/* Unmap shared memory, whose frames pagedir_destroy() must not
+	  free while other processes may still use them */
+	shm_exit ();
+#endif
 
-	ASSERT (process_w);
-	ASSERT (children);
+	enum intr_level old_level = intr_disable ();
 
-	/* Allow write back to executable once exited */
-	if (!lock_held_by_current_thread (&file_sys_lock))
-		lock_acquire (&file_sys_lock);
+	int exit_status = cur->process_w.exit_status;
 
+	/* Allow write back to executable once exited */
 	if (parent->executable)
 	{
 		file_allow_write (parent->executable);
 		file_close (parent->executable);
 	}
-	lock_release (&file_sys_lock);
 
 	/* Print exiting message */
 	printf ("%s: exit(%i)\n", cur->name, exit_status);
-	for (e = list_begin (children); e != list_end (children);)
-	{
-		struct child_status *child;
-		child = list_entry (e, struct child_status, child_elem);
-		e = list_remove (e);
-		free (child);
-	}
+
+	/* Free children processes list when terminating */
+	release_children (cur);
 
 	if (is_thread (parent) && parent->status != THREAD_DYING)
 		update_child_status (parent, cur->tid, exit_status);
@@ -377,10 +398,6 @@ bool load (const char *file_name, char *args, void (**eip) (void), void **esp)
 		goto done;
 	process_activate ();
 
-  	/* Acquire the file system lock as we will perform operations on the file
-       system */
-  	lock_acquire(&file_sys_lock);
-
 	/* Open executable file. */
 	file = filesys_open (file_name);
 	if (file == NULL)
@@ -474,9 +491,6 @@ done:
 	/* We arrive here whether the load is successful or not. */
 	file_close (file);
 
-	/* Release the file_sys_lock before returning */
-	lock_release (&file_sys_lock);
-
 	return success;
 }
 
@@ -763,3 +777,278 @@ static void update_child_status (struct thread *parent, pid_t child_pid,
 		}
 	}
 }
+
+/* Frees the children processes list of thread t. Must be called with
+  interrupts disabled */
+static void release_children (struct thread *t)
+{
+	struct list *children = &t->process_w.children_processes;
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (children); e != list_end (children);)
+	{
+		struct child_status *child;
+		child = list_entry (e, struct child_status, child_elem);
+		e = list_remove (e);
+		free (child);
+	}
+}
+
+/* Terminates the current process with exit status status, unless it is
+  terminating already. Its other threads exit the next time they would
+  return to user mode, and are woken up if they sleep on a futex or a
+  pipe. */
+void process_terminate (int status)
+{
+	struct thread *leader = thread_current ()->leader;
+
+	lock_acquire (&leader->threads_lock);
+	if (!leader->exiting)
+	{
+		leader->exiting = true;
+		leader->process_w.exit_status = status;
+		if (!list_empty (&leader->user_threads))
+		{
+			futex_wake_all ();
+			pipe_wake_all ();
+		}
+	}
+	lock_release (&leader->threads_lock);
+	thread_exit ();
+}
+
+/* Returns true if the current thread belongs to a terminating process, in
+  which case it must exit instead of returning to user mode */
+bool process_killed (void)
+{
+	return thread_current ()->leader->exiting;
+}
+
+/* Starts a new thread in the current process, running at eip on a stack of
+  its own with arg0 and arg1 as the arguments of a call. Returns the new
+  thread's id, or TID_ERROR if it cannot be created. */
+pid_t process_thread_spawn (void (*eip) (void), void *arg0, void *arg1)
+{
+	struct thread *leader = thread_current ()->leader;
+	struct user_thread *ut;
+	struct list_elem *e;
+	uint32_t used = 0;
+	uint32_t *frame;
+	uint8_t *kpage;
+	void *upage;
+	tid_t tid;
+
+	ut = calloc (1, sizeof *ut);
+	if (ut == NULL)
+		return TID_ERROR;
+	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+	if (kpage == NULL)
+	{
+		free (ut);
+		return TID_ERROR;
+	}
+
+	/* Take the lowest free stack slot */
+	lock_acquire (&leader->threads_lock);
+	for (e = list_begin (&leader->user_threads);
+	     e != list_end (&leader->user_threads); e = list_next (e))
+		used |= 1u << (list_entry (e, struct user_thread, elem)->slot - 1);
+	if (leader->exiting || used == UINT32_MAX)
+	{
+		lock_release (&leader->threads_lock);
+		palloc_free_page (kpage);
+		free (ut);
+		return TID_ERROR;
+	}
+	ut->tid = TID_ERROR;
+	ut->slot = __builtin_ctz (~used) + 1;
+	upage = stack_page (ut->slot);
+	if (!install_page (upage, kpage, true))
+	{
+		lock_release (&leader->threads_lock);
+		palloc_free_page (kpage);
+		free (ut);
+		return TID_ERROR;
+	}
+	list_push_back (&leader->user_threads, &ut->elem);
+	lock_release (&leader->threads_lock);
+
+	/* Lay out a call frame: a null return address, then the arguments */
+	frame = (uint32_t *) (kpage + PGSIZE) - 3;
+	frame[0] = 0;
+	frame[1] = (uint32_t) arg0;
+	frame[2] = (uint32_t) arg1;
+
+	ut->leader = leader;
+	ut->eip = eip;
+	ut->esp = (uint8_t *) upage + PGSIZE - 3 * sizeof (uint32_t);
+
+	tid = thread_create (leader->name, PRI_DEFAULT, start_user_thread, ut);
+
+	lock_acquire (&leader->threads_lock);
+	if (tid == TID_ERROR)
+	{
+		list_remove (&ut->elem);
+		cond_broadcast (&leader->thread_exited, &leader->threads_lock);
+		pagedir_clear_page (leader->pagedir, upage);
+		palloc_free_page (kpage);
+		free (ut);
+	}
+	else
+		ut->tid = tid;
+	lock_release (&leader->threads_lock);
+	return tid;
+}
+
+/* A thread function that joins the process described by user thread
+   record ut_ and starts running its user code. */
+static void start_user_thread (void *ut_)
+{
+	struct user_thread *ut = (struct user_thread *) ut_;
+	struct thread *leader = ut->leader;
+	struct thread *cur = thread_current ();
+	struct intr_frame if_;
+
+	cur->leader = leader;
+	cur->uthread = ut;
+	if (leader->cwd != NULL)
+		cur->cwd = dir_reopen (leader->cwd);
+#ifdef VM
+	cur->spt = leader->spt;
+#endif
+	cur->pagedir = leader->pagedir;
+	process_activate ();
+
+	if (process_killed ())
+		thread_exit ();
+
+	memset (&if_, 0, sizeof if_);
+	if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+	if_.cs = SEL_UCSEG;
+	if_.eflags = FLAG_IF | FLAG_MBS;
+	if_.eip = ut->eip;
+	if_.esp = ut->esp;
+
+	asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+	NOT_REACHED ();
+}
+
+/* Waits for thread tid of the current process to exit and returns the
+ * status it passed to thread_exit.
+ * Returns -1 immediately if tid is not another thread of the current
+ * process, other than its main thread, or if some thread is joining it
+ * already. */
+int process_thread_join (pid_t tid)
+{
+	struct thread *cur = thread_current ();
+	struct thread *leader = cur->leader;
+	struct list_elem *e;
+	int status = -1;
+
+	lock_acquire (&leader->threads_lock);
+	for (e = list_begin (&leader->user_threads);
+	     e != list_end (&leader->user_threads); e = list_next (e))
+	{
+		struct user_thread *ut = list_entry (e, struct user_thread, elem);
+		if (ut->tid == tid && tid != TID_ERROR && ut != cur->uthread &&
+		    !ut->joined)
+		{
+			ut->joined = true;
+			while (!ut->exited)
+				cond_wait (&leader->thread_exited, &leader->threads_lock);
+			status = ut->exit_status;
+			list_remove (&ut->elem);
+			free (ut);
+			break;
+		}
+	}
+	lock_release (&leader->threads_lock);
+	return status;
+}
+
+/* Ends the current thread with exit status status. Ending the main thread
+  ends the whole process. */
+void process_thread_exit (int status)
+{
+	struct thread *cur = thread_current ();
+
+	if (cur->uthread == NULL)
+		process_terminate (status);
+	cur->uthread->exit_status = status;
+	thread_exit ();
+}
+
+/* Makes the other threads of the current process, whose main thread is
+  exiting, exit as well. Waits until they have, then frees their records. */
+static void stop_user_threads (void)
+{
+	struct thread *cur = thread_current ();
+	struct list *threads = &cur->user_threads;
+	struct list_elem *e;
+
+	lock_acquire (&cur->threads_lock);
+	if (!cur->exiting)
+	{
+		cur->exiting = true;
+		if (!list_empty (threads))
+		{
+			futex_wake_all ();
+			pipe_wake_all ();
+		}
+	}
+	e = list_begin (threads);
+	while (e != list_end (threads))
+	{
+		if (!list_entry (e, struct user_thread, elem)->exited)
+		{
+			cond_wait (&cur->thread_exited, &cur->threads_lock);
+			e = list_begin (threads);
+		}
+		else
+			e = list_next (e);
+	}
+	while (!list_empty (threads))
+		free (list_entry (list_pop_front (threads), struct user_thread, elem));
+	lock_release (&cur->threads_lock);
+}
+
+/* Frees the resources of the current thread, which is not the main thread
+  of its process, and tells the threads waiting for it */
+static void exit_user_thread (void)
+{
+	struct thread *cur = thread_current ();
+	struct thread *leader = cur->leader;
+	struct user_thread *ut = cur->uthread;
+	void *upage = stack_page (ut->slot);
+	void *kpage = pagedir_get_page (cur->pagedir, upage);
+
+	dir_close (cur->cwd);
+	cur->cwd = NULL;
+
+	enum intr_level old_level = intr_disable ();
+	release_children (cur);
+	intr_set_level (old_level);
+
+	/* The page directory belongs to the main thread, which destroys it once
+	  all threads are gone. Only the stack is ours */
+	pagedir_clear_page (cur->pagedir, upage);
+	palloc_free_page (kpage);
+	cur->pagedir = NULL;
+	pagedir_activate (NULL);
+
+	lock_acquire (&leader->threads_lock);
+	ut->exited = true;
+	cond_broadcast (&leader->thread_exited, &leader->threads_lock);
+	lock_release (&leader->threads_lock);
+}
+
+/* Returns the user address of the stack page of user thread stack slot
+  slot, counting from 1: the top page of the slot'th run of
+  THREAD_STACK_PAGES pages below STACK_BASE */
+static void *stack_page (int slot)
+{
+	return (uint8_t *) STACK_BASE
+		- ((slot - 1) * THREAD_STACK_PAGES + 1) * PGSIZE;
+}
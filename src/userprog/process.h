@@ -1,7 +1,9 @@
 #ifndef USERPROG_PROCESS_H
 #define USERPROG_PROCESS_H
 
+#include <debug.h>
 #include <list.h>
+#include <stdbool.h>
 
 #define ARGS_MAX_SIZE 256 /* Maximum space allocated for arguments in stack */
 #define ARGS_MAX_COUNT 31 /* Maximum number of arguments passed to program */
@@ -9,6 +11,20 @@
 #define LOADED_SUCCESS 0
 #define LOADED_FAILED -1
 
+/* The main thread's stack may grow down to STACK_BASE */
+#define MAX_STACK_SIZE 0x800000
+#define STACK_BASE (PHYS_BASE - MAX_STACK_SIZE)
+#define IS_STACK_ACCESS(x) (((STACK_BASE) <= (x) && (x) < (PHYS_BASE)))
+
+/* User threads other than the main one get a slot of THREAD_STACK_PAGES
+  pages of address space each, of which only the top page is mapped as
+  the thread's stack; the rest stays unmapped, so that an overflow faults
+  instead of running into the next slot. The slots lie right below
+  STACK_BASE, out of the way of the main thread's stack, which may grow
+  anywhere above it */
+#define MAX_USER_THREADS 32
+#define THREAD_STACK_PAGES 16
+
 /* Computes the next adress where a byte should start */
 #define last_address_alligned(X) (X - (uint32_t) X % 4)
 
@@ -21,9 +37,28 @@ struct child_status
   struct list_elem child_elem;          /* Children list elem */
 };
 
+struct user_thread
+{
+  pid_t tid;                            /* Thread id */
+  struct thread *leader;                /* Main thread of the process */
+  int slot;                             /* Stack slot, from 1 */
+  void (*eip) (void);                   /* Entry point */
+  void *esp;                            /* Initial stack pointer */
+  int exit_status;                      /* Value passed to thread_exit */
+  bool exited;                          /* Thread has exited */
+  bool joined;                          /* Some thread is joining it */
+  struct list_elem elem;                /* Leader's user_threads elem */
+};
+
 pid_t process_execute (const char *file_name);
 int process_wait (pid_t child_pid);
 void process_exit (void);
 void process_activate (void);
+void process_terminate (int status) NO_RETURN;
+bool process_killed (void);
+
+pid_t process_thread_spawn (void (*eip) (void), void *arg0, void *arg1);
+int process_thread_join (pid_t tid);
+void process_thread_exit (int status) NO_RETURN;
 
 #endif /* userprog/process.h */
@@ -1,15 +1,29 @@
 #include "../devices/shutdown.h"
+#include "../filesys/directory.h"
 #include "../filesys/file.h"
 #include "../filesys/filesys.h"
+#include "../filesys/inode.h"
 #include "../src/devices/input.h"
 #include "../threads/interrupt.h"
 #include "../threads/malloc.h"
+#include "../threads/palloc.h"
 #include "../threads/thread.h"
 #include "../threads/vaddr.h"
+#include "../userprog/futex.h"
+#include "../userprog/pipe.h"
 #include "../userprog/process.h"
 #include "../userprog/syscall.h"
+#include "../userprog/uaccess.h"
+#include <limits.h>
+#include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <syscall-ring.h>
+#include <uio.h>
+#ifdef VM
+#include "../vm/shm.h"
+#endif
 
 //#define DEBUG
 
@@ -26,13 +40,9 @@
 #endif
 
 /* User pointers handling functions */
-static int get_user (const uint8_t *uaddr);
-static bool put_user (uint8_t *udst, uint8_t byte) UNUSED;
 static uint32_t load_number (void *vaddr);
 static char *load_address (void *vaddr);
 static bool is_valid_address (const void *addr);
-static bool is_valid_buffer (const void *baddr, int size);
-static bool is_valid_string (const char *str);
 
 static void syscall_handler (struct intr_frame *);
 
@@ -50,17 +60,50 @@ static void write (struct intr_frame *f);
 static void seek (struct intr_frame *f);
 static void tell (struct intr_frame *f);
 static void close (struct intr_frame *f);
+static void chdir (struct intr_frame *f);
+static void mkdir (struct intr_frame *f);
+static void readdir (struct intr_frame *f);
+static void isdir (struct intr_frame *f);
+static void inumber (struct intr_frame *f);
+static void ring_enter (struct intr_frame *f);
+static void readv (struct intr_frame *f);
+static void writev (struct intr_frame *f);
+static void pread (struct intr_frame *f);
+static void pwrite (struct intr_frame *f);
+static void copy_file_range (struct intr_frame *f);
+static void pipe (struct intr_frame *f);
+static void futex_wait (struct intr_frame *f);
+static void futex_wake (struct intr_frame *f);
+static void thread_spawn (struct intr_frame *f);
+static void thread_join (struct intr_frame *f);
+static void exit_thread (struct intr_frame *f);
+#ifdef VM
+static void shm_create (struct intr_frame *f);
+static void shm_attach (struct intr_frame *f);
+static void shm_detach (struct intr_frame *f);
+#endif
 
 /* Helpers */
-static void *find_file (int fd);
+static int alloc_fd (struct file_descriptor *descriptor);
+static struct file_descriptor *find_file (int fd);
+static void put_file (struct file_descriptor *descriptor);
+static struct iovec *load_iovec (const struct iovec *uiov, int iovcnt,
+				 bool write);
 static void close_open_file (int fd);
+static char *load_string (const char *ustr);
+static int read_to_user (struct file_descriptor *descriptor,
+			 const struct iovec *iov, int iovcnt, off_t offset);
+static int write_from_user (struct file_descriptor *descriptor,
+			    const struct iovec *iov, int iovcnt, off_t offset);
 
 /* System calls array */
 static syscall_func_t syscall_func[MAX_SYSCALL_SIZE];
 
+/* System calls that may be queued on a syscall ring */
+static bool ring_allowed[MAX_SYSCALL_SIZE];
+
 void syscall_init (void)
 {
-	lock_init (&file_sys_lock);
 	intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 
 	/* Initialize syscall function pointers */
@@ -77,6 +120,39 @@ void syscall_init (void)
 	syscall_func[SYS_SEEK] = seek;
 	syscall_func[SYS_TELL] = tell;
 	syscall_func[SYS_CLOSE] = close;
+	syscall_func[SYS_CHDIR] = chdir;
+	syscall_func[SYS_MKDIR] = mkdir;
+	syscall_func[SYS_READDIR] = readdir;
+	syscall_func[SYS_ISDIR] = isdir;
+	syscall_func[SYS_INUMBER] = inumber;
+	syscall_func[SYS_RING_ENTER] = ring_enter;
+	syscall_func[SYS_READV] = readv;
+	syscall_func[SYS_WRITEV] = writev;
+	syscall_func[SYS_PREAD] = pread;
+	syscall_func[SYS_PWRITE] = pwrite;
+	syscall_func[SYS_COPY_FILE_RANGE] = copy_file_range;
+	syscall_func[SYS_PIPE] = pipe;
+	syscall_func[SYS_FUTEX_WAIT] = futex_wait;
+	syscall_func[SYS_FUTEX_WAKE] = futex_wake;
+	syscall_func[SYS_THREAD_SPAWN] = thread_spawn;
+	syscall_func[SYS_THREAD_JOIN] = thread_join;
+	syscall_func[SYS_THREAD_EXIT] = exit_thread;
+#ifdef VM
+	syscall_func[SYS_SHM_CREATE] = shm_create;
+	syscall_func[SYS_SHM_ATTACH] = shm_attach;
+	syscall_func[SYS_SHM_DETACH] = shm_detach;
+#endif
+
+	ring_allowed[SYS_OPEN] = true;
+	ring_allowed[SYS_FILESIZE] = true;
+	ring_allowed[SYS_READ] = true;
+	ring_allowed[SYS_WRITE] = true;
+	ring_allowed[SYS_SEEK] = true;
+	ring_allowed[SYS_TELL] = true;
+	ring_allowed[SYS_CLOSE] = true;
+	ring_allowed[SYS_READV] = true;
+	ring_allowed[SYS_WRITEV] = true;
+	ring_allowed[SYS_COPY_FILE_RANGE] = true;
 }
 
 static void syscall_handler (struct intr_frame *f)
@@ -84,7 +160,8 @@ static void syscall_handler (struct intr_frame *f)
 	uint32_t sys_call_number = load_number (f->esp);
 
 	/* Check if system call number is valid */
-	if (sys_call_number > SYS_CLOSE)
+	if (sys_call_number >= MAX_SYSCALL_SIZE ||
+	    syscall_func[sys_call_number] == NULL)
 	{
 		exit_fail ();
 		return;
@@ -110,24 +187,27 @@ static void halt (struct intr_frame *f UNUSED) { shutdown_power_off (); }
 static void exit (struct intr_frame *f)
 {
 	int status = load_number (COMPUTE_ARG_1 (f->esp));
-	close_all_files ();
-	thread_current ()->process_w.exit_status = status;
-	thread_exit ();
+	process_terminate (status);
 }
 
 /* Function to be called for immediate exit fail */
 void exit_fail (void)
 {
-	close_all_files ();
-	thread_current ()->process_w.exit_status = EXIT_FAIL;
-	thread_exit ();
+	process_terminate (EXIT_FAIL);
 }
 
 /* Runs the executable whose name is given in cmd line */
 static void exec (struct intr_frame *f)
 {
-	char *cmd_line = load_address (COMPUTE_ARG_1 (f->esp));
+	char *cmd_line = load_string (load_address (COMPUTE_ARG_1 (f->esp)));
+
+	if (cmd_line == NULL)
+	{
+		f->eax = -1;
+		return;
+	}
 	f->eax = process_execute (cmd_line);
+	palloc_free_page (cmd_line);
 }
 
 /* Waits for a child process pid and retrieves the child’s exit status. */
@@ -142,101 +222,92 @@ static void wait (struct intr_frame *f)
  * Creating a new file does not open it! */
 static void create (struct intr_frame *f)
 {
-	const char *file = load_address (COMPUTE_ARG_1 (f->esp));
-	unsigned initial_size = *(unsigned *) (COMPUTE_ARG_2 (f->esp));
-	bool result;
+	const char *ufile = load_address (COMPUTE_ARG_1 (f->esp));
+	unsigned initial_size = load_number (COMPUTE_ARG_2 (f->esp));
+	char *file = load_string (ufile);
 
-	/* Check validity of file string and exit immediately if false */
-	if (!is_valid_string (file))
+	if (file == NULL)
 	{
 		f->eax = false;
 		return;
 	}
-
-	lock_acquire (&file_sys_lock);
-	result = filesys_create (file, initial_size);
-	lock_release (&file_sys_lock);
-	f->eax = result;
+	f->eax = filesys_create (file, initial_size);
+	palloc_free_page (file);
 }
 
 /* Deletes the file called file. Returns true if successful, false otherwise. */
 static void remove (struct intr_frame *f)
 {
-	const char *file = load_address (COMPUTE_ARG_1 (f->esp));
-	bool result;
+	char *file = load_string (load_address (COMPUTE_ARG_1 (f->esp)));
 
-	/* Check validity of file string and exit immediately if false */
-	if (!is_valid_string (file))
+	if (file == NULL)
 	{
 		f->eax = false;
 		return;
 	}
-
-	lock_acquire (&file_sys_lock);
-	result = filesys_remove (file);
-	lock_release (&file_sys_lock);
-	f->eax = result;
+	f->eax = filesys_remove (file);
+	palloc_free_page (file);
 }
 
 /* Opens the file called "file". Returns a non negative integer handle called
  * a “file descriptor” (fd),or -1 if the file could not be opened */
 static void open (struct intr_frame *f)
 {
-	const char *file = load_address (COMPUTE_ARG_1 (f->esp));
+	char *file = load_string (load_address (COMPUTE_ARG_1 (f->esp)));
 	struct file_descriptor *fd;
 	struct file *new_file;
 
-	/* Check validity of file string and exit immediately if false */
-	if (!is_valid_string (file))
+	if (file == NULL)
 	{
 		f->eax = -1;
 		return;
 	}
-
-	lock_acquire (&file_sys_lock);
 	new_file = filesys_open (file);
+	palloc_free_page (file);
 
 	if (new_file == NULL)
 	{
-		lock_release (&file_sys_lock);
 		f->eax = -1;
 		return;
 	}
 
-	if (list_size (&thread_current ()->files_opened) >= MAX_OPEN_FILES)
+	fd = calloc (1, sizeof (*fd));
+	if (fd == NULL || alloc_fd (fd) < 0)
 	{
+		free (fd);
 		file_close (new_file);
-		lock_release (&file_sys_lock);
 		f->eax = -1;
 		return;
 	}
-
-	fd = calloc (1, sizeof (*fd));
-	fd->num = ++thread_current ()->fd_count;
-	fd->owner = thread_current()->tid;
+	fd->owner = thread_current ()->leader->tid;
 	fd->file_struct = new_file;
-	list_push_back (&thread_current ()->files_opened, &fd->elem);
 
-	lock_release (&file_sys_lock);
+	/* Directories are also read through a directory handle */
+	struct inode *inode = file_get_inode (new_file);
+	if (inode_is_dir (inode))
+		fd->dir_struct = dir_open (inode_reopen (inode));
+
 	f->eax = fd->num;
 }
 
 /* Returns the size, in bytes, of the file open as fd */
 static void filesize (struct intr_frame *f)
 {
-	int fd = *(int *) (COMPUTE_ARG_1 (f->esp));
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
 	struct file_descriptor *descriptor;
 	int size = -1;
-	lock_acquire (&file_sys_lock);
 
 	/* Descriptor takes the value of of the open file */
 	descriptor = find_file (fd);
 
 	/* If any file was found, get its size here */
 	if (descriptor != NULL)
-		size = file_length (descriptor->file_struct);
+	{
+		if (descriptor->pipe == NULL)
+			size = file_length (descriptor->file_struct);
+		put_file (descriptor);
+	}
 
-	lock_release (&file_sys_lock);
 	f->eax = size;
 }
 
@@ -248,34 +319,39 @@ static void read (struct intr_frame *f)
 	unsigned size = load_number (COMPUTE_ARG_3 (f->esp));
 
 	/* Check validity of buffer and exit immediately if false */
-	if (!is_valid_buffer (buffer, size))
+	if (!user_access_ok (buffer, size, true))
 		exit_fail ();
 
+	/* The characters that we are reading have to fill the buffer*/
 	if (fd == STDIN_FILENO)
 	{
-		/* The characters that we are reading have to fill the buffer*/
-		uint8_t *copy_buffer = (uint8_t *) buffer;
-		for (unsigned i = 0; i < size; i++)
-			copy_buffer[i] = input_getc ();
-		f->eax = size;
+		struct iovec iov = { buffer, size };
+		f->eax = read_to_user (NULL, &iov, 1, -1);
 		return;
 	}
 
 	/* Extract the file */
-	lock_acquire (&file_sys_lock);
 	struct file_descriptor *descriptor = find_file (fd);
 
 	if (!descriptor)
 	{
-		lock_release (&file_sys_lock);
 		exit_fail ();
 		return;
 	}
 
-	int no_of_read_characters = file_read (descriptor->file_struct, buffer, size);
-	lock_release (&file_sys_lock);
-
-	f->eax = no_of_read_characters;
+	/* Pipes can only be read from their read end */
+	if (descriptor->pipe != NULL)
+		f->eax = descriptor->pipe_writer
+		         ? -1 : pipe_read (descriptor->pipe, buffer, size);
+	/* Directories can only be read with readdir */
+	else if (descriptor->dir_struct != NULL)
+		f->eax = -1;
+	else
+	{
+		struct iovec iov = { buffer, size };
+		f->eax = read_to_user (descriptor, &iov, 1, -1);
+	}
+	put_file (descriptor);
 }
 
 /* Writes size bytes from buffer to the open file fd. Returns the number of
@@ -287,33 +363,39 @@ static void write (struct intr_frame *f)
 	unsigned size = load_number (COMPUTE_ARG_3 (f->esp));
 
 	/* Check validity of buffer and exit immediately if false */
-	if (!is_valid_buffer (buffer, size))
+	if (!user_access_ok (buffer, size, false))
 		exit_fail ();
 
 	/* Check if write to console is needed and perform it */
 	if (fd == STDOUT_FILENO)
 	{
-		putbuf (buffer, size);
-		f->eax = size;
+		struct iovec iov = { buffer, size };
+		f->eax = write_from_user (NULL, &iov, 1, -1);
 		return;
 	}
 
 	/* Find the corresponding file and write */
-	lock_acquire (&file_sys_lock);
-
 	struct file_descriptor *descriptor = find_file (fd);
 
 	if (!descriptor)
 	{
-		lock_release (&file_sys_lock);
 		exit_fail ();
 		return;
 	}
 
-	int bytes_written = file_write (descriptor->file_struct, buffer, size);
-	lock_release (&file_sys_lock);
-
-	f->eax = bytes_written;
+	/* Pipes can only be written to at their write end */
+	if (descriptor->pipe != NULL)
+		f->eax = descriptor->pipe_writer
+		         ? pipe_write (descriptor->pipe, buffer, size) : -1;
+	/* Directories cannot be written to */
+	else if (descriptor->dir_struct != NULL)
+		f->eax = -1;
+	else
+	{
+		struct iovec iov = { buffer, size };
+		f->eax = write_from_user (descriptor, &iov, 1, -1);
+	}
+	put_file (descriptor);
 }
 
 /* Changes the next byte to be read or written in open file fd to position */
@@ -323,13 +405,14 @@ static void seek (struct intr_frame *f)
 	unsigned position = load_number (COMPUTE_ARG_2 (f->esp));
 
 	struct file_descriptor *descriptor;
-	lock_acquire (&file_sys_lock);
 
 	descriptor = find_file (fd);
 	if (descriptor != NULL)
-		file_seek (descriptor->file_struct, position);
-
-	lock_release (&file_sys_lock);
+	{
+		if (descriptor->pipe == NULL)
+			file_seek (descriptor->file_struct, position);
+		put_file (descriptor);
+	}
 }
 
 /* Returns the position of the next byte to be read / written in open file fd */
@@ -338,13 +421,15 @@ static void tell (struct intr_frame *f)
 	int fd = load_number (COMPUTE_ARG_1 (f->esp));
 	int position = 0;
 	struct file_descriptor *descriptor;
-	lock_acquire (&file_sys_lock);
 
 	descriptor = find_file (fd);
 	if (descriptor != NULL)
-		position = file_tell (descriptor->file_struct);
+	{
+		if (descriptor->pipe == NULL)
+			position = file_tell (descriptor->file_struct);
+		put_file (descriptor);
+	}
 
-	lock_release (&file_sys_lock);
 	f->eax = position;
 }
 
@@ -353,93 +438,934 @@ static void tell (struct intr_frame *f)
 static void close (struct intr_frame *f)
 {
 	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+
+	close_open_file (fd);
+}
+
+/* Changes the current working directory of the process to dir, which may
+ * be relative or absolute. Returns true if successful, false on failure. */
+static void chdir (struct intr_frame *f)
+{
+	char *dir = load_string (load_address (COMPUTE_ARG_1 (f->esp)));
+
+	if (dir == NULL)
+	{
+		f->eax = false;
+		return;
+	}
+	f->eax = filesys_chdir (dir);
+	palloc_free_page (dir);
+}
+
+/* Creates the directory named dir, which may be relative or absolute.
+ * Returns true if successful, false on failure. */
+static void mkdir (struct intr_frame *f)
+{
+	char *dir = load_string (load_address (COMPUTE_ARG_1 (f->esp)));
+
+	if (dir == NULL)
+	{
+		f->eax = false;
+		return;
+	}
+	f->eax = filesys_mkdir (dir);
+	palloc_free_page (dir);
+}
+
+/* Reads a directory entry from file descriptor fd, which must represent a
+ * directory, into name. Returns false if there are no entries left. */
+static void readdir (struct intr_frame *f)
+{
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+	char *name = load_address (COMPUTE_ARG_2 (f->esp));
+	char kname[NAME_MAX + 1];
 	struct file_descriptor *descriptor;
-	lock_acquire (&file_sys_lock);
+
+	if (!user_access_ok (name, NAME_MAX + 1, true))
+		exit_fail ();
+
 	descriptor = find_file (fd);
-	if (descriptor != NULL && thread_current ()->tid == descriptor->owner)
-		close_open_file (fd);
-	lock_release (&file_sys_lock);
+	if (descriptor == NULL)
+	{
+		f->eax = false;
+		return;
+	}
+
+	f->eax = descriptor->dir_struct != NULL
+	         && dir_readdir (descriptor->dir_struct, kname);
+	put_file (descriptor);
+	if (f->eax && copy_to_user (name, kname, strlen (kname) + 1) != 0)
+		exit_fail ();
 }
 
-/* Iterate through the opened files and retrieve the one with num = fd */
-static void *find_file (int fd)
+/* Returns true if fd represents a directory, false if it represents an
+ * ordinary file. */
+static void isdir (struct intr_frame *f)
 {
-	struct thread *t = thread_current ();
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+	struct file_descriptor *descriptor = find_file (fd);
 
-	struct list_elem *e;
-	for (e = list_begin (&t->files_opened); e != list_end (&t->files_opened);
-	     e = list_next (e))
+	f->eax = descriptor != NULL && descriptor->dir_struct != NULL;
+	if (descriptor != NULL)
+		put_file (descriptor);
+}
+
+/* Returns the inode number of the inode associated with fd. */
+static void inumber (struct intr_frame *f)
+{
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+	struct file_descriptor *descriptor = find_file (fd);
+
+	if (descriptor == NULL)
 	{
-		struct file_descriptor *file_desc;
-		file_desc = list_entry (e, struct file_descriptor, elem);
-		if (file_desc->num == fd)
-			return file_desc;
+		f->eax = -1;
+		return;
 	}
-	return NULL;
+
+	if (descriptor->pipe != NULL)
+		f->eax = -1;
+	else
+		f->eax = inode_get_inumber (file_get_inode (descriptor->file_struct));
+	put_file (descriptor);
 }
 
-/* Helper function which closes the requested file and frees resources. */
-static void close_open_file (int fd)
+/* Reads from the file open as fd into the iovcnt buffers described by iov,
+ * in order, as one read.  Returns the number of bytes read. */
+static void readv (struct intr_frame *f)
 {
-	struct file_descriptor *descriptor = find_file (fd);
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+	const struct iovec *uiov = (const struct iovec *)
+		load_address (COMPUTE_ARG_2 (f->esp));
+	int iovcnt = load_number (COMPUTE_ARG_3 (f->esp));
+	struct file_descriptor *descriptor;
+	struct iovec *iov;
+
+	if (iovcnt == 0)
+	{
+		f->eax = 0;
+		return;
+	}
+	iov = load_iovec (uiov, iovcnt, true);
+	if (iov == NULL)
+	{
+		f->eax = -1;
+		return;
+	}
+
+	if (fd == STDIN_FILENO)
+		f->eax = read_to_user (NULL, iov, iovcnt, -1);
+	else if ((descriptor = find_file (fd)) == NULL)
+	{
+		free (iov);
+		exit_fail ();
+	}
+	else
+	{
+		if (descriptor->pipe != NULL)
+			f->eax = descriptor->pipe_writer
+			         ? -1 : pipe_readv (descriptor->pipe, iov, iovcnt);
+		else if (descriptor->dir_struct != NULL)
+			f->eax = -1;
+		else
+			f->eax = read_to_user (descriptor, iov, iovcnt, -1);
+		put_file (descriptor);
+	}
+	free (iov);
+}
+
+/* Writes the iovcnt buffers described by iov to the file open as fd, in
+ * order, as one write.  Returns the number of bytes written. */
+static void writev (struct intr_frame *f)
+{
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+	const struct iovec *uiov = (const struct iovec *)
+		load_address (COMPUTE_ARG_2 (f->esp));
+	int iovcnt = load_number (COMPUTE_ARG_3 (f->esp));
+	struct file_descriptor *descriptor;
+	struct iovec *iov;
+
+	if (iovcnt == 0)
+	{
+		f->eax = 0;
+		return;
+	}
+	iov = load_iovec (uiov, iovcnt, false);
+	if (iov == NULL)
+	{
+		f->eax = -1;
+		return;
+	}
+
+	if (fd == STDOUT_FILENO)
+		f->eax = write_from_user (NULL, iov, iovcnt, -1);
+	else if ((descriptor = find_file (fd)) == NULL)
+	{
+		free (iov);
+		exit_fail ();
+	}
+	else
+	{
+		if (descriptor->pipe != NULL)
+		{
+			/* Fails only if nothing could be written: this is not a write
+			 * end, or every read end is closed. */
+			int total = descriptor->pipe_writer ? 0 : -1;
+			for (int i = 0; i < iovcnt && total >= 0; i++)
+			{
+				int cnt = pipe_write (descriptor->pipe, iov[i].iov_base,
+				                      iov[i].iov_len);
+				if (cnt < 0)
+				{
+					if (total == 0)
+						total = -1;
+					break;
+				}
+				total += cnt;
+				if ((size_t) cnt < iov[i].iov_len)
+					break;
+			}
+			f->eax = total;
+		}
+		else if (descriptor->dir_struct != NULL)
+			f->eax = -1;
+		else
+			f->eax = write_from_user (descriptor, iov, iovcnt, -1);
+		put_file (descriptor);
+	}
+	free (iov);
+}
+
+/* Reads size bytes from the file open as fd into buffer, starting at
+ * position offset, without moving the file position. */
+static void pread (struct intr_frame *f)
+{
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+	void *buffer = load_address (COMPUTE_ARG_2 (f->esp));
+	unsigned size = load_number (COMPUTE_ARG_3 (f->esp));
+	int offset = load_number (COMPUTE_ARG_4 (f->esp));
+	struct file_descriptor *descriptor;
+
+	if (!user_access_ok (buffer, size, true))
+		exit_fail ();
+
+	/* The console has no positions */
+	if (fd == STDIN_FILENO || fd == STDOUT_FILENO)
+	{
+		f->eax = -1;
+		return;
+	}
+
+	descriptor = find_file (fd);
+	if (descriptor == NULL)
+		exit_fail ();
+	if (descriptor->dir_struct != NULL || descriptor->pipe != NULL ||
+	    offset < 0)
+		f->eax = -1;
+	else
+	{
+		struct iovec iov = { buffer, size };
+		f->eax = read_to_user (descriptor, &iov, 1, offset);
+	}
+	put_file (descriptor);
+}
 
-	list_remove (&descriptor->elem);
+/* Writes size bytes from buffer to the file open as fd, starting at
+ * position offset, without moving the file position. */
+static void pwrite (struct intr_frame *f)
+{
+	int fd = load_number (COMPUTE_ARG_1 (f->esp));
+	const void *buffer = load_address (COMPUTE_ARG_2 (f->esp));
+	unsigned size = load_number (COMPUTE_ARG_3 (f->esp));
+	int offset = load_number (COMPUTE_ARG_4 (f->esp));
+	struct file_descriptor *descriptor;
+
+	if (!user_access_ok (buffer, size, false))
+		exit_fail ();
+
+	/* The console has no positions */
+	if (fd == STDIN_FILENO || fd == STDOUT_FILENO)
+	{
+		f->eax = -1;
+		return;
+	}
+
+	descriptor = find_file (fd);
+	if (descriptor == NULL)
+		exit_fail ();
+	if (descriptor->dir_struct != NULL || descriptor->pipe != NULL ||
+	    offset < 0)
+		f->eax = -1;
+	else
+	{
+		struct iovec iov = { (void *) buffer, size };
+		f->eax = write_from_user (descriptor, &iov, 1, offset);
+	}
+	put_file (descriptor);
+}
+
+/* Copies up to len bytes from the file open as fd_in to the file open as
+ * fd_out, from and to their current positions, entirely inside the kernel.
+ * Returns the number of bytes copied, or -1 if both fds are for the same
+ * file and the ranges overlap. */
+static void copy_file_range (struct intr_frame *f)
+{
+	int fd_in = load_number (COMPUTE_ARG_1 (f->esp));
+	int fd_out = load_number (COMPUTE_ARG_2 (f->esp));
+	unsigned len = load_number (COMPUTE_ARG_3 (f->esp));
+	struct file_descriptor *in, *out;
+
+	/* Only files can be copied */
+	if (fd_in == STDIN_FILENO || fd_in == STDOUT_FILENO ||
+	    fd_out == STDIN_FILENO || fd_out == STDOUT_FILENO)
+	{
+		f->eax = -1;
+		return;
+	}
+
+	in = find_file (fd_in);
+	out = find_file (fd_out);
+	if (in == NULL || out == NULL)
+	{
+		if (in != NULL)
+			put_file (in);
+		if (out != NULL)
+			put_file (out);
+		exit_fail ();
+	}
+	if (len > INT_MAX)
+		len = INT_MAX;
+	if (in->dir_struct != NULL || out->dir_struct != NULL ||
+	    in->pipe != NULL || out->pipe != NULL)
+		f->eax = -1;
+	else
+		f->eax = file_copy_range (in->file_struct, out->file_struct, len);
+	put_file (in);
+	put_file (out);
+}
+
+/* Creates a pipe and stores the fds of its read and write ends in fds[0]
+ * and fds[1]. Returns true if successful, false otherwise. Pipe ends are
+ * the only fds that a child process inherits. */
+static void pipe (struct intr_frame *f)
+{
+	int *fds = (int *) load_address (COMPUTE_ARG_1 (f->esp));
+	struct file_descriptor *ends[2];
+	struct pipe *p;
+	int kfds[2];
+
+	if (!user_access_ok (fds, sizeof kfds, true))
+		exit_fail ();
+
+	f->eax = false;
+	p = pipe_create ();
+	if (p == NULL)
+		return;
+	ends[0] = calloc (1, sizeof *ends[0]);
+	ends[1] = calloc (1, sizeof *ends[1]);
+	if (ends[0] == NULL || ends[1] == NULL)
+	{
+		free (ends[0]);
+		free (ends[1]);
+		pipe_close (p, false);
+		pipe_close (p, true);
+		return;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		ends[i]->owner = thread_current ()->leader->tid;
+		ends[i]->pipe = p;
+		ends[i]->pipe_writer = i == 1;
+	}
+	kfds[0] = alloc_fd (ends[0]);
+	kfds[1] = kfds[0] < 0 ? -1 : alloc_fd (ends[1]);
+	if (kfds[1] < 0)
+	{
+		if (kfds[0] >= 0)
+			close_open_file (kfds[0]);
+		else
+		{
+			free (ends[0]);
+			pipe_close (p, false);
+		}
+		free (ends[1]);
+		pipe_close (p, true);
+		return;
+	}
+
+	if (copy_to_user (fds, kfds, sizeof kfds) != 0)
+		exit_fail ();
+	f->eax = true;
+}
+
+/* Sleeps until woken if the word at addr still holds expected; returns 0
+ * once woken, or -1 if the word held something else */
+static void futex_wait (struct intr_frame *f)
+{
+	int *addr = (int *) load_address (COMPUTE_ARG_1 (f->esp));
+	int expected = load_number (COMPUTE_ARG_2 (f->esp));
+
+	f->eax = futex_sleep (addr, expected);
+}
+
+/* Wakes up to count threads sleeping on the word at addr and returns the
+ * number woken */
+static void futex_wake (struct intr_frame *f)
+{
+	int *addr = (int *) load_address (COMPUTE_ARG_1 (f->esp));
+	int count = load_number (COMPUTE_ARG_2 (f->esp));
+
+	f->eax = futex_wakeup (addr, count);
+}
+
+/* Starts a new thread in the current process, which calls eip with arg0 and
+ * arg1 as arguments, and returns its id, or -1 */
+static void thread_spawn (struct intr_frame *f)
+{
+	void *eip = load_address (COMPUTE_ARG_1 (f->esp));
+	void *arg0 = load_address (COMPUTE_ARG_2 (f->esp));
+	void *arg1 = load_address (COMPUTE_ARG_3 (f->esp));
+
+	f->eax = process_thread_spawn (eip, arg0, arg1);
+}
+
+/* Waits for thread tid of the current process to exit and returns its exit
+ * status, or -1 */
+static void thread_join (struct intr_frame *f)
+{
+	pid_t tid = load_number (COMPUTE_ARG_1 (f->esp));
+
+	f->eax = process_thread_join (tid);
+}
+
+/* Ends the current thread, or the whole process in its main thread */
+static void exit_thread (struct intr_frame *f)
+{
+	int status = load_number (COMPUTE_ARG_1 (f->esp));
+
+	process_thread_exit (status);
+}
+
+#ifdef VM
+/* Creates a shared memory segment of at least size bytes and returns its
+ * id, or -1 */
+static void shm_create (struct intr_frame *f)
+{
+	unsigned size = load_number (COMPUTE_ARG_1 (f->esp));
+
+	f->eax = shm_alloc (size);
+}
+
+/* Maps shared memory segment id at the page-aligned address addr and
+ * returns addr, or NULL */
+static void shm_attach (struct intr_frame *f)
+{
+	int id = load_number (COMPUTE_ARG_1 (f->esp));
+	void *addr = load_address (COMPUTE_ARG_2 (f->esp));
+
+	f->eax = (uint32_t) shm_map (id, addr);
+}
+
+/* Unmaps the shared memory segment attached at addr */
+static void shm_detach (struct intr_frame *f)
+{
+	void *addr = load_address (COMPUTE_ARG_1 (f->esp));
+
+	f->eax = shm_unmap (addr);
+}
+#endif
+
+/* Runs up to to_submit system calls queued on the submission queue of the
+ * syscall ring ring, posting their results to its completion queue, and
+ * returns the number run.  Stops early when either queue runs out.  Each
+ * entry is copied in before it runs and each completion copied out after,
+ * so the kernel never dereferences the ring; returns -1 if any of it
+ * cannot be accessed.  A queued call goes through its ordinary handler
+ * with the user's entry standing in for the user stack. */
+static void ring_enter (struct intr_frame *f)
+{
+	struct syscall_ring *ring = (struct syscall_ring *)
+		load_address (COMPUTE_ARG_1 (f->esp));
+	unsigned to_submit = load_number (COMPUTE_ARG_2 (f->esp));
+	uint32_t sq_head, sq_tail, cq_head, cq_tail;
+	unsigned done = 0;
+
+	f->eax = -1;
+	if (copy_from_user (&sq_head, &ring->sq_head, sizeof sq_head) != 0 ||
+	    copy_from_user (&sq_tail, &ring->sq_tail, sizeof sq_tail) != 0 ||
+	    copy_from_user (&cq_head, &ring->cq_head, sizeof cq_head) != 0 ||
+	    copy_from_user (&cq_tail, &ring->cq_tail, sizeof cq_tail) != 0)
+		return;
+
+	while (done < to_submit && sq_head != sq_tail &&
+	       cq_tail - cq_head < RING_ENTRIES)
+	{
+		struct ring_sqe *usqe = &ring->sq[sq_head % RING_ENTRIES];
+		struct ring_sqe sqe;
+		struct ring_cqe cqe;
+		struct intr_frame op;
+
+		if (copy_from_user (&sqe, usqe, sizeof sqe) != 0)
+			return;
+		op.esp = usqe;
+		op.eax = -1;
+		if (sqe.number < MAX_SYSCALL_SIZE && ring_allowed[sqe.number])
+		{
+			op.eax = 0;
+			syscall_func[sqe.number](&op);
+		}
+
+		cqe.user_data = sqe.user_data;
+		cqe.result = op.eax;
+		sq_head++;
+		cq_tail++;
+		if (copy_to_user (&ring->cq[(cq_tail - 1) % RING_ENTRIES], &cqe,
+				  sizeof cqe) != 0 ||
+		    copy_to_user (&ring->sq_head, &sq_head, sizeof sq_head) != 0 ||
+		    copy_to_user (&ring->cq_tail, &cq_tail, sizeof cq_tail) != 0)
+			return;
+		done++;
+	}
+	f->eax = done;
+}
+
+/* The file descriptor table of a thread is an array indexed by fd,
+ * together with a bitmap of the fds in use, one bit per fd, in 32-bit
+ * words. Looking up a fd is a single array access, and the lowest free
+ * fd is found a word at a time. Both grow by doubling, up to
+ * MAX_OPEN_FILES fds. Fds 0 and 1 are the console and are never
+ * allocated. */
+
+/* Number of fds in a new table */
+#define FD_TABLE_INIT 16
+
+/* Bits in a word of the fd bitmap */
+#define FD_WORD_BITS 32
+
+/* Grows the current thread's fd table to hold at least one more fd.
+ * Returns false if it is already at MAX_OPEN_FILES or memory is short. */
+static bool grow_fd_table (void)
+{
+	struct thread *t = thread_current ()->leader;
+	int new_size = t->fd_table_size == 0 ? FD_TABLE_INIT
+	                                     : t->fd_table_size * 2;
+	struct file_descriptor **table;
+	uint32_t *used;
+
+	if (t->fd_table_size >= MAX_OPEN_FILES)
+		return false;
+	if (new_size > MAX_OPEN_FILES)
+		new_size = MAX_OPEN_FILES;
+
+	table = calloc (new_size, sizeof *table);
+	used = calloc (DIV_ROUND_UP (new_size, FD_WORD_BITS), sizeof *used);
+	if (table == NULL || used == NULL)
+	{
+		free (table);
+		free (used);
+		return false;
+	}
+
+	if (t->fd_table_size == 0)
+		used[0] = (1u << STDIN_FILENO) | (1u << STDOUT_FILENO);
+	else
+	{
+		memcpy (table, t->fd_table, t->fd_table_size * sizeof *table);
+		memcpy (used, t->fd_used,
+		        DIV_ROUND_UP (t->fd_table_size, FD_WORD_BITS) * sizeof *used);
+	}
+	free (t->fd_table);
+	free (t->fd_used);
+	t->fd_table = table;
+	t->fd_used = used;
+	t->fd_table_size = new_size;
+	return true;
+}
+
+/* Gives DESCRIPTOR the lowest free fd of the current thread, storing
+ * it in DESCRIPTOR->num, and returns it, or -1 if there is none. */
+static int alloc_fd (struct file_descriptor *descriptor)
+{
+	struct thread *t = thread_current ()->leader;
+	int word_cnt;
+	int i, fd;
+
+	lock_acquire (&t->fd_lock);
+	word_cnt = DIV_ROUND_UP (t->fd_table_size, FD_WORD_BITS);
+	for (i = 0; i < word_cnt; i++)
+		if (t->fd_used[i] != UINT32_MAX)
+			break;
+	fd = i * FD_WORD_BITS;
+	if (i < word_cnt)
+		fd += __builtin_ctz (~t->fd_used[i]);
+	if (fd >= t->fd_table_size && !grow_fd_table ())
+	{
+		lock_release (&t->fd_lock);
+		return -1;
+	}
+
+	t->fd_used[fd / FD_WORD_BITS] |= 1u << (fd % FD_WORD_BITS);
+	t->fd_table[fd] = descriptor;
+	descriptor->num = fd;
+	descriptor->ref_cnt = 1;
+	lock_release (&t->fd_lock);
+	return fd;
+}
+
+/* Returns the current thread's open file with num = fd, or NULL.  The
+ * caller holds a reference on it, which it must drop with put_file(), so
+ * that a close of fd by another thread cannot free it in the meantime. */
+static struct file_descriptor *find_file (int fd)
+{
+	struct thread *t = thread_current ()->leader;
+	struct file_descriptor *descriptor = NULL;
+
+	lock_acquire (&t->fd_lock);
+	if (fd >= 0 && fd < t->fd_table_size)
+		descriptor = t->fd_table[fd];
+	if (descriptor != NULL)
+		descriptor->ref_cnt++;
+	lock_release (&t->fd_lock);
+	return descriptor;
+}
+
+/* Drops a reference to descriptor, closing its file and freeing it if
+ * that was the last one. */
+static void put_file (struct file_descriptor *descriptor)
+{
+	struct thread *t = thread_current ()->leader;
+	bool last;
+
+	lock_acquire (&t->fd_lock);
+	last = --descriptor->ref_cnt == 0;
+	lock_release (&t->fd_lock);
+	if (!last)
+		return;
+
+	if (descriptor->pipe != NULL)
+		pipe_close (descriptor->pipe, descriptor->pipe_writer);
+	dir_close (descriptor->dir_struct);
 	file_close (descriptor->file_struct);
 	free (descriptor);
 }
 
-/* When exiting, make sure all files belonging to this thread are closed */
-void
-close_all_files (void)
+/* Copies the iovcnt-element iovec array at user address uiov into a new
+ * kernel array, which the caller must free, and validates each buffer it
+ * describes once, for writing if write is true.  Returns NULL if iovcnt is
+ * out of range, the buffers total more than INT_MAX bytes, or memory runs
+ * out.  Terminates the process if any address is bad. */
+static struct iovec *load_iovec (const struct iovec *uiov, int iovcnt,
+				 bool write)
 {
-	struct thread *curr = thread_current ();
+	struct iovec *iov;
+	size_t total = 0;
 
-	struct list_elem *e;
-	if (!lock_held_by_current_thread (&file_sys_lock))
-		lock_acquire (&file_sys_lock);
+	if (iovcnt <= 0 || iovcnt > IOV_MAX)
+		return NULL;
+	iov = malloc (iovcnt * sizeof *iov);
+	if (iov == NULL)
+		return NULL;
 
-	while (!list_empty (&curr->files_opened))
+	if (copy_from_user (iov, uiov, iovcnt * sizeof *iov) != 0)
 	{
-		e = list_begin (&curr->files_opened);
-		int fd = list_entry (e, struct file_descriptor, elem)->num;
-		struct file_descriptor *descriptor = find_file (fd);
-		if (descriptor != NULL && curr->tid == descriptor->owner)
-			close_open_file (fd);
+		free (iov);
+		exit_fail ();
 	}
-	lock_release (&file_sys_lock);
+	for (int i = 0; i < iovcnt; i++)
+	{
+		if (!user_access_ok (iov[i].iov_base, iov[i].iov_len, write))
+		{
+			free (iov);
+			exit_fail ();
+		}
+		total += iov[i].iov_len;
+		if (total > INT_MAX)
+		{
+			free (iov);
+			return NULL;
+		}
+	}
+	return iov;
 }
 
-/* Reads a byte at user virtual address UADDR.
-UADDR must be below PHYS_BASE.
-Returns the byte value if successful, -1 if a segfault
-occurred. */
-static int get_user (const uint8_t *uaddr)
+/* Copies the null-terminated string at user address ustr into a new page,
+ * which the caller must free with palloc_free_page(), so that the file
+ * system never reads it from user memory.  Returns NULL if the string does
+ * not fit in a page or memory is short.  Terminates the process if the
+ * string is not readable. */
+static char *load_string (const char *ustr)
 {
-	/* Check user address is below PHYS_BASE here to avoid adding this
-	 * pre-condition to the function and make sure it is met. */
-	if (!is_user_vaddr (uaddr))
+	char *kstr = palloc_get_page (0);
+	int len;
+
+	if (kstr == NULL)
+		return NULL;
+	len = copy_string_from_user (kstr, ustr, PGSIZE);
+	if (len < 0)
+	{
+		palloc_free_page (kstr);
+		exit_fail ();
+	}
+	if (len == PGSIZE)
+	{
+		palloc_free_page (kstr);
+		return NULL;
+	}
+	return kstr;
+}
+
+/* File and console data passes between user memory and the file system a
+ * chunk at a time, through a kernel bounce buffer, with copy_to_user() and
+ * copy_from_user().  The file system and the disk driver never touch user
+ * memory, so a buffer that another thread unmaps in the middle of a call
+ * only cuts the call short, instead of faulting in the kernel while it
+ * holds file system locks. */
+
+/* Size of a bounce buffer, in pages */
+#define BOUNCE_PAGES 4
+
+/* Allocates a bounce buffer and sets *size to its size in bytes.  Falls
+ * back to a single page if memory is tight.  Returns NULL if memory is
+ * short. */
+static uint8_t *get_bounce (size_t *size)
+{
+	uint8_t *bounce = palloc_get_multiple (0, BOUNCE_PAGES);
+
+	*size = BOUNCE_PAGES * PGSIZE;
+	if (bounce == NULL)
+	{
+		bounce = palloc_get_page (0);
+		*size = PGSIZE;
+	}
+	return bounce;
+}
+
+/* Copies size bytes between the kernel buffer kbuf and the user buffers
+ * described by iov, starting at byte *ofs of iov[*i], and advances *i and
+ * *ofs past them: into the user buffers if to_user is true, out of them
+ * otherwise.  Returns false if a user buffer is no longer mapped. */
+static bool copy_iov (const struct iovec *iov, int *i, size_t *ofs,
+		      uint8_t *kbuf, size_t size, bool to_user)
+{
+	while (size > 0)
+	{
+		uint8_t *ubuf = (uint8_t *) iov[*i].iov_base + *ofs;
+		size_t chunk = iov[*i].iov_len - *ofs;
+
+		if (chunk > size)
+			chunk = size;
+		if (to_user ? copy_to_user (ubuf, kbuf, chunk) != 0
+		            : copy_from_user (kbuf, ubuf, chunk) != 0)
+			return false;
+		kbuf += chunk;
+		size -= chunk;
+		*ofs += chunk;
+		if (*ofs == iov[*i].iov_len)
+		{
+			(*i)++;
+			*ofs = 0;
+		}
+	}
+	return true;
+}
+
+/* Returns the total size of the iovcnt buffers described by iov, but at
+ * most INT_MAX */
+static size_t iov_size (const struct iovec *iov, int iovcnt)
+{
+	size_t total = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+	{
+		total += iov[i].iov_len;
+		if (total > INT_MAX)
+			return INT_MAX;
+	}
+	return total;
+}
+
+/* Reads from the file open as descriptor, or from the keyboard if
+ * descriptor is NULL, into the iovcnt user buffers described by iov, in
+ * order, through a bounce buffer.  Reads at the file's position, or at
+ * offset, leaving the position alone, if offset is not negative.  Returns
+ * the number of bytes read, or -1 if memory is short or nothing could be
+ * stored because a buffer is no longer mapped. */
+static int read_to_user (struct file_descriptor *descriptor,
+			 const struct iovec *iov, int iovcnt, off_t offset)
+{
+	size_t left = iov_size (iov, iovcnt);
+	size_t bounce_size, ofs = 0;
+	uint8_t *bounce;
+	int total = 0, i = 0;
+
+	if (left == 0)
+		return 0;
+	bounce = get_bounce (&bounce_size);
+	if (bounce == NULL)
 		return -1;
 
-	int result;
-	asm("movl $1f, %0; movzbl %1, %0; 1:" : "=&a"(result) : "m"(*uaddr));
-	return result;
+	while (left > 0)
+	{
+		off_t want = left < bounce_size ? left : bounce_size;
+		off_t cnt;
+
+		if (descriptor == NULL)
+			for (cnt = 0; cnt < want; cnt++)
+				bounce[cnt] = input_getc ();
+		else if (offset < 0)
+			cnt = file_read (descriptor->file_struct, bounce, want);
+		else
+			cnt = file_read_at (descriptor->file_struct, bounce, want,
+			                    offset + total);
+
+		if (!copy_iov (iov, &i, &ofs, bounce, cnt, true))
+		{
+			if (total == 0)
+				total = -1;
+			break;
+		}
+		total += cnt;
+		left -= cnt;
+		if (cnt < want)
+			break;
+	}
+	palloc_free_multiple (bounce, bounce_size / PGSIZE);
+	return total;
 }
 
-/* Writes BYTE to user address UDST.
-UDST must be below PHYS_BASE.
-Returns true if successful, false if a segfault occurred. */
-static bool put_user (uint8_t *udst, uint8_t byte)
+/* Writes the iovcnt user buffers described by iov, in order, to the file
+ * open as descriptor, or to the console if descriptor is NULL, through a
+ * bounce buffer.  Writes at the file's position, or at offset, leaving the
+ * position alone, if offset is not negative.  Returns the number of bytes
+ * written, or -1 if memory is short or nothing could be read because a
+ * buffer is no longer mapped. */
+static int write_from_user (struct file_descriptor *descriptor,
+			    const struct iovec *iov, int iovcnt, off_t offset)
 {
-	/* Check user address is below PHYS_BASE here to avoid adding this
-	 * pre-condition to the function and make sure it is met. */
-	if (!is_user_vaddr (udst))
-		return false;
+	size_t left = iov_size (iov, iovcnt);
+	size_t bounce_size, ofs = 0;
+	uint8_t *bounce;
+	int total = 0, i = 0;
+
+	if (left == 0)
+		return 0;
+	bounce = get_bounce (&bounce_size);
+	if (bounce == NULL)
+		return -1;
 
-	int error_code;
-	asm("movl $1f, %0; movb %b2, %1; 1:"
-	    : "=&a"(error_code), "=m"(*udst)
-	    : "q"(byte));
-	return error_code != -1;
+	while (left > 0)
+	{
+		off_t want = left < bounce_size ? left : bounce_size;
+		off_t cnt;
+
+		if (!copy_iov (iov, &i, &ofs, bounce, want, false))
+		{
+			if (total == 0)
+				total = -1;
+			break;
+		}
+
+		if (descriptor == NULL)
+		{
+			putbuf ((const char *) bounce, want);
+			cnt = want;
+		}
+		else if (offset < 0)
+			cnt = file_write (descriptor->file_struct, bounce, want);
+		else
+			cnt = file_write_at (descriptor->file_struct, bounce, want,
+			                     offset + total);
+
+		total += cnt;
+		left -= cnt;
+		if (cnt < want)
+			break;
+	}
+	palloc_free_multiple (bounce, bounce_size / PGSIZE);
+	return total;
+}
+
+/* Gives the current thread, a process that is being loaded, its own
+ * copies of the pipe ends open in parent, at the same fds, so that a parent
+ * can set up a pipeline before exec. Other fds are not inherited. The
+ * parent is blocked waiting for us to finish loading. */
+void inherit_pipes (struct thread *parent)
+{
+	struct thread *t = thread_current ();
+
+	/* The fd table belongs to the main thread of the parent process */
+	parent = parent->leader;
+	lock_acquire (&parent->fd_lock);
+
+	for (int fd = 0; fd < parent->fd_table_size; fd++)
+	{
+		struct file_descriptor *parent_end = parent->fd_table[fd];
+		struct file_descriptor *descriptor;
+
+		if (parent_end == NULL || parent_end->pipe == NULL)
+			continue;
+		while (fd >= t->fd_table_size)
+			if (!grow_fd_table ())
+				goto done;
+		descriptor = calloc (1, sizeof *descriptor);
+		if (descriptor == NULL)
+			goto done;
+
+		descriptor->num = fd;
+		descriptor->owner = t->tid;
+		descriptor->pipe = parent_end->pipe;
+		descriptor->pipe_writer = parent_end->pipe_writer;
+		descriptor->ref_cnt = 1;
+		pipe_dup (descriptor->pipe, descriptor->pipe_writer);
+		t->fd_table[fd] = descriptor;
+		t->fd_used[fd / FD_WORD_BITS] |= 1u << (fd % FD_WORD_BITS);
+	}
+done:
+	lock_release (&parent->fd_lock);
+}
+
+/* Helper function which removes fd from the current process's table, if
+ * it is open there and owned by the process, and drops the table's
+ * reference to it. The file itself is closed once no system call is using
+ * it any more. */
+static void close_open_file (int fd)
+{
+	struct thread *t = thread_current ()->leader;
+	struct file_descriptor *descriptor = NULL;
+
+	lock_acquire (&t->fd_lock);
+	if (fd >= 0 && fd < t->fd_table_size)
+		descriptor = t->fd_table[fd];
+	if (descriptor != NULL && descriptor->owner == t->tid)
+	{
+		t->fd_table[fd] = NULL;
+		t->fd_used[fd / FD_WORD_BITS] &= ~(1u << (fd % FD_WORD_BITS));
+	}
+	else
+		descriptor = NULL;
+	lock_release (&t->fd_lock);
+	if (descriptor != NULL)
+		put_file (descriptor);
+}
+
+/* When exiting, make sure all files belonging to this process are closed.
+ * Called by its main thread once the other threads are gone. */
+void
+close_all_files (void)
+{
+	struct thread *curr = thread_current ();
+
+	ASSERT (curr->leader == curr);
+
+	int fd;
+
+	for (fd = 0; fd < curr->fd_table_size; fd++)
+		close_open_file (fd);
+	free (curr->fd_table);
+	free (curr->fd_used);
+	curr->fd_table = NULL;
+	curr->fd_used = NULL;
+	curr->fd_table_size = 0;
 }
 
 /* Receives a memory address and validates it.
@@ -447,10 +1373,11 @@ static bool put_user (uint8_t *udst, uint8_t byte)
  * Otherwise, it terminates the user process. */
 static uint32_t load_number (void *vaddr)
 {
-	if (get_user ((uint8_t *) vaddr) == -1)
-		exit_fail ();
+	uint32_t number;
 
-	return *((uint32_t *) vaddr);
+	if (copy_from_user (&number, vaddr, sizeof number) != 0)
+		exit_fail ();
+	return number;
 }
 
 /* Receives a memory address and validates it.
@@ -458,12 +1385,14 @@ static uint32_t load_number (void *vaddr)
  * Otherwise, it terminates the user process. */
 static char *load_address (void *vaddr)
 {
-	if (get_user ((uint8_t *) vaddr) == -1)
+	char *address;
+
+	if (copy_from_user (&address, vaddr, sizeof address) != 0)
 	{
 		exit_fail ();
 		return NULL;
 	}
-	return *((char **) vaddr);
+	return address;
 }
 
 /* Checks if the address is valid and corresponds to a user pointer */
@@ -473,33 +1402,3 @@ static bool is_valid_address (const void *addr)
 		return false;
 	return true;
 }
-
-/* Handles special case of buffer inspection. */
-static bool is_valid_buffer (const void *baddr, int size)
-{
-	char *buffer = (char *) baddr;
-	for (int i = 1; i < size; i++)
-		if (get_user ((uint8_t *) (buffer + i)) == -1)
-			return false;
-	return true;
-}
-
-/* Handles special case of string inspection. */
-static bool is_valid_string (const char *str)
-{
-	int i = 0;
-	int chr = get_user ((uint8_t *) (str + i));
-
-	if (chr == -1)
-		return false;
-
-	while (chr != '\0')
-	{
-		if (get_user ((uint8_t *) (str + i)) == -1)
-			return false;
-		else
-			chr = get_user ((uint8_t *) (str + i));
-		i++;
-	}
-	return true;
-}
@@ -10,18 +10,19 @@
 
 #define ARG_STEP 4
 
-#define MAX_OPEN_FILES 126
+#define MAX_OPEN_FILES 1024
 #define MAX_SYSCALL_SIZE 128
 
 #define COMPUTE_ARG_0(x) (x)
 #define COMPUTE_ARG_1(x) ((x) + ARG_STEP)
 #define COMPUTE_ARG_2(x) ((x) + (2 * ARG_STEP))
 #define COMPUTE_ARG_3(x) ((x) + (3 * ARG_STEP))
+#define COMPUTE_ARG_4(x) ((x) + (4 * ARG_STEP))
 
 typedef void (*syscall_func_t) (struct intr_frame *f);
 
-/* File system lock */
-struct lock file_sys_lock;
+/* SYSENTER entry point, in syscall-entry.S. */
+void sysenter_entry (void);
 
 /* structure for the file descriptors */
 struct file_descriptor
@@ -29,11 +30,15 @@ struct file_descriptor
 	int num;
 	pid_t owner;
 	struct file *file_struct;
-	struct list_elem elem;
+	struct dir *dir_struct;			/* Non-null if the file is a directory */
+	struct pipe *pipe;				/* Non-null if this is a pipe end */
+	bool pipe_writer;				/* True for the write end of a pipe */
+	int ref_cnt;					/* Table's and system calls' references */
 };
 
 void syscall_init (void);
 void exit_fail (void);
 void close_all_files (void);
+void inherit_pipes (struct thread *parent);
 
 #endif /* userprog/syscall.h */
@@ -5,6 +5,7 @@
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "userprog/syscall.h"
 
 /* The Task-State Segment (TSS).
 
@@ -75,6 +76,34 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+/* Model-specific registers read by SYSENTER.  SYSENTER loads CS
+   from MSR_SYSENTER_CS and SS from the selector after it, and
+   SYSEXIT loads the user CS and SS from the two selectors after
+   that, which is how gdt.c lays out SEL_KCSEG, SEL_KDSEG,
+   SEL_UCSEG, and SEL_UDSEG.  See [IA32-v2b] "SYSENTER". */
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* True if the CPU supports SYSENTER and we have set it up. */
+static bool sysenter_enabled;
+
+/* Writes VALUE to model-specific register MSR. */
+static inline void
+wrmsr (uint32_t msr, uint64_t value) 
+{
+  asm volatile ("wrmsr" : : "c" (msr), "A" (value));
+}
+
+/* Returns true if CPUID reports SYSENTER and SYSEXIT. */
+static bool
+cpu_has_sysenter (void) 
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & (1u << 11)) != 0;
+}
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void) 
@@ -85,6 +114,15 @@ tss_init (void)
   tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
+
+  /* Enable the SYSENTER fast path for system calls, alongside
+     `int $0x30'.  The stack pointer is set by tss_update(). */
+  if (cpu_has_sysenter ()) 
+    {
+      wrmsr (MSR_SYSENTER_CS, SEL_KCSEG);
+      wrmsr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+      sysenter_enabled = true;
+    }
   tss_update ();
 }
 
@@ -96,11 +134,13 @@ tss_get (void)
   return tss;
 }
 
-/* Sets the ring 0 stack pointer in the TSS to point to the end
-   of the thread stack. */
+/* Sets the ring 0 stack pointer in the TSS, and the one used by
+   SYSENTER, to point to the end of the thread stack. */
 void
 tss_update (void) 
 {
   ASSERT (tss != NULL);
   tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  if (sysenter_enabled)
+    wrmsr (MSR_SYSENTER_ESP, (uint32_t) tss->esp0);
 }
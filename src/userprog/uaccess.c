@@ -0,0 +1,178 @@
+#include "userprog/uaccess.h"
+#include <stdint.h>
+#include <string.h>
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* Access to user memory.
+
+   System calls validate user buffers one page at a time against
+   the page directory (and, with VM, the supplemental page table),
+   rather than touching every byte.
+
+   The data itself, and strings, go through copy_from_user() and
+   copy_to_user(), which copy with REP MOVS and may fault
+   partway.  Each instruction that may fault on a user address
+   has an entry in the exception table, in section __ex_table,
+   giving the address to resume at.  page_fault() calls
+   uaccess_fixup() for faults in the kernel, which redirects the
+   interrupted code there, so that the copy returns the number
+   of bytes it could not copy instead of killing the process. */
+
+/* An exception table entry. */
+struct exception_entry
+  {
+    uintptr_t insn;             /* Address of instruction that may fault. */
+    uintptr_t fixup;            /* Address to continue at if it does. */
+  };
+
+/* Exception table, collected by the linker script. */
+extern const struct exception_entry _start_ex_table[], _end_ex_table[];
+
+/* Returns true if UADDR through UADDR + SIZE lies entirely in
+   user virtual memory. */
+static bool
+user_range_ok (const void *uaddr, size_t size) 
+{
+  uintptr_t start = (uintptr_t) uaddr;
+  return start + size >= start && start + size <= (uintptr_t) PHYS_BASE;
+}
+
+/* Returns true if user page UPAGE of the current process may be
+   accessed by the kernel, for writing if WRITE is true. */
+static bool
+page_ok (const void *upage, bool write) 
+{
+  struct thread *t = thread_current ();
+
+  if (pagedir_get_page (t->pagedir, upage) != NULL)
+    return !write || pagedir_is_writable (t->pagedir, upage);
+#ifdef VM
+  {
+    struct supp_pt_entry *e = find_page (t->spt, (void *) upage);
+    if (e != NULL)
+      return !write || e->writable || e->page_status == ZERO;
+  }
+#endif
+  return false;
+}
+
+/* Returns true if the SIZE bytes at UADDR are user memory that
+   the kernel may read, or write if WRITE is true.  Checks each
+   page in the range once. */
+bool
+user_access_ok (const void *uaddr, size_t size, bool write) 
+{
+  const uint8_t *start = uaddr;
+  const uint8_t *upage;
+
+  if (size == 0)
+    return true;
+  if (uaddr == NULL || !user_range_ok (uaddr, size))
+    return false;
+
+  for (upage = pg_round_down (start); upage < start + size;
+       upage += PGSIZE)
+    if (!page_ok (upage, write))
+      return false;
+  return true;
+}
+
+/* Copies SIZE bytes from SRC to DST, either of which may be a
+   user address.  Returns the number of bytes that could not be
+   copied because of a page fault, so 0 on success. */
+static size_t
+copy_user (void *dst, const void *src, size_t size) 
+{
+  size_t tail = size % 4;
+  size_t left;
+  int d0, d1;
+
+  /* If REP MOVSL faults, ECX words and the TAIL bytes remain.
+     If REP MOVSB faults, ECX bytes remain. */
+  asm volatile ("1:\trep movsl\n\t"
+                "movl %[tail], %%ecx\n"
+                "2:\trep movsb\n\t"
+                "jmp 4f\n"
+                "3:\tleal (%[tail],%%ecx,4), %%ecx\n"
+                "4:\n\t"
+                ".pushsection __ex_table, \"a\"\n\t"
+                ".long 1b, 3b\n\t"
+                ".long 2b, 4b\n\t"
+                ".popsection"
+                : "=&c" (left), "=&D" (d0), "=&S" (d1)
+                : "0" (size / 4), "1" (dst), "2" (src), [tail] "r" (tail)
+                : "memory");
+  return left;
+}
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.  Returns the number of bytes not copied, so 0 on
+   success. */
+size_t
+copy_from_user (void *dst, const void *usrc, size_t size) 
+{
+  if (!user_range_ok (usrc, size))
+    return size;
+  return copy_user (dst, usrc, size);
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.  Returns the number of bytes not copied, so 0 on
+   success. */
+size_t
+copy_to_user (void *udst, const void *src, size_t size) 
+{
+  if (!user_range_ok (udst, size))
+    return size;
+  return copy_user (udst, src, size);
+}
+
+/* Copies the null-terminated string at user address USRC into
+   DST, which has room for SIZE bytes including the null
+   terminator, a page at a time.  Returns the length of the
+   string, SIZE if it does not fit, or -1 if part of it could not
+   be read. */
+int
+copy_string_from_user (char *dst, const char *usrc, size_t size) 
+{
+  size_t len = 0;
+
+  while (len < size) 
+    {
+      const char *p = usrc + len;
+      size_t chunk = PGSIZE - pg_ofs (p);
+      char *nul;
+
+      if (chunk > size - len)
+        chunk = size - len;
+      if (copy_from_user (dst + len, p, chunk) != 0)
+        return -1;
+      nul = memchr (dst + len, '\0', chunk);
+      if (nul != NULL)
+        return nul - dst;
+      len += chunk;
+    }
+  return size;
+}
+
+/* If F is a page fault at an instruction listed in the
+   exception table, arranges for it to resume at the fixup
+   address and returns true.  Otherwise, returns false. */
+bool
+uaccess_fixup (struct intr_frame *f) 
+{
+  const struct exception_entry *e;
+
+  for (e = _start_ex_table; e < _end_ex_table; e++)
+    if (e->insn == (uintptr_t) f->eip) 
+      {
+        f->eip = (void (*) (void)) e->fixup;
+        return true;
+      }
+  return false;
+}
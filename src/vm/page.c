@@ -28,14 +28,15 @@ void destroy_supp_pt (struct supp_pt *spt)
   free (spt);
 }
 
-/* Install the frame corresponding */
+/* Install the frame corresponding.  Returns NULL if UPAGE is
+   already present or memory is short. */
 struct supp_pt_entry *
 install_frame (struct supp_pt *supp, void *upage, void *kpage)
 {
   struct supp_pt_entry *entry = calloc (1, sizeof (struct supp_pt_entry));
 
   if (!entry)
-    exit_fail ();
+    return NULL;
 
   entry->dirty_bit = false;
   entry->upage = upage;
@@ -81,9 +82,9 @@ struct supp_pt_entry *install_page_zero (struct supp_pt *supp, void *upage)
 /* Get the requested user page from the hash table */
 struct supp_pt_entry *find_page (struct supp_pt *supp, void *upage)
 {
-  struct supp_pt_entry *entry = calloc (1, sizeof (struct supp_pt_entry));
-  entry->upage = pg_round_down (upage);
-  struct hash_elem *elem = hash_find (&supp->hash_table, &entry->list_elem);
+  struct supp_pt_entry entry;
+  entry.upage = pg_round_down (upage);
+  struct hash_elem *elem = hash_find (&supp->hash_table, &entry.list_elem);
   if (!elem)
     return NULL;
   return hash_entry(elem, struct supp_pt_entry, list_elem);
@@ -95,6 +96,17 @@ bool has_page (struct supp_pt *supp, void *upage)
   return find_page (supp, upage) != NULL;
 }
 
+/* Remove the requested user page from the hash table */
+void remove_page (struct supp_pt *supp, void *upage)
+{
+  struct supp_pt_entry *entry = find_page (supp, upage);
+
+  if (entry == NULL)
+    return;
+  hash_delete (&supp->hash_table, &entry->list_elem);
+  free (entry);
+}
+
 struct supp_pt_entry *
 install_page_file (struct supp_pt *supp, void *upage, void *kpage,
                    struct file *file, off_t
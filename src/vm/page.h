@@ -9,7 +9,8 @@ enum page_status {
   ZERO,
   SWAPPED,
   FILE_SYS,
-  IN_FRAME
+  IN_FRAME,
+  SHARED
 };
 
 struct supp_pt {
@@ -59,6 +60,9 @@ struct supp_pt_entry *find_page (struct supp_pt *supp, void *upage);
 /* Check if the requested user page is in the hash table */
 bool has_page (struct supp_pt *supp, void *upage);
 
+/* Remove the requested user page from the hash table */
+void remove_page (struct supp_pt *supp, void *upage);
+
 /* lazy loading */
 bool load_page (struct supp_pt *supp, void *upage);
 
@@ -0,0 +1,307 @@
+#include "vm/shm.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Shared memory segments.
+
+   A segment is a run of zeroed user frames that any process can
+   map, by id, into its own address space.  Every mapping of a
+   segment, plus the one held by its creator, counts as a
+   reference; the frames are freed when the last reference is
+   dropped.
+
+   Shared frames must never reach pagedir_destroy(), which would
+   free them behind the other processes' backs, so shm_exit()
+   unmaps them first. */
+
+/* Largest segment, in pages. */
+#define SHM_MAX_PAGES 256
+
+struct shm_segment
+  {
+    int id;                     /* Identifier handed to user code. */
+    size_t page_cnt;            /* Number of pages. */
+    void **frames;              /* Kernel addresses of the frames. */
+    int ref_cnt;                /* References, see above. */
+    struct list_elem elem;      /* Element in `segments'. */
+  };
+
+/* A reference a process holds on a segment, in the
+   `shm_mappings' list of the process's main thread.  UPAGE is
+   where the segment is mapped, or a null pointer for the
+   creator's reference. */
+struct shm_mapping
+  {
+    struct shm_segment *segment;
+    void *upage;
+    struct list_elem elem;
+  };
+
+/* All live segments, and the next id to assign. */
+static struct list segments;
+static int next_id;
+
+/* Guards `segments', `next_id', every segment's `ref_cnt' and
+   every process's `shm_mappings', and serializes attaching and
+   detaching. */
+static struct lock shm_lock;
+
+static struct shm_segment *find_segment (int id);
+static void put_segment (struct shm_segment *);
+static void free_segment (struct shm_segment *);
+static bool add_mapping (struct shm_segment *, void *upage);
+static void unmap (void *upage, size_t page_cnt);
+
+/* Initializes the shared memory module. */
+void
+shm_init (void)
+{
+  list_init (&segments);
+  lock_init (&shm_lock);
+  next_id = 1;
+}
+
+/* Creates a segment of SIZE bytes, rounded up to whole pages,
+   referenced by the running process until it exits.  Returns the
+   segment's id, or -1 if SIZE is out of range or memory is
+   short. */
+int
+shm_alloc (size_t size)
+{
+  struct shm_segment *s;
+  size_t page_cnt = DIV_ROUND_UP (size, PGSIZE);
+  size_t i;
+  int id;
+
+  if (page_cnt == 0 || page_cnt > SHM_MAX_PAGES)
+    return -1;
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    return -1;
+  s->page_cnt = page_cnt;
+  s->frames = calloc (page_cnt, sizeof *s->frames);
+  if (s->frames == NULL)
+    {
+      free (s);
+      return -1;
+    }
+  for (i = 0; i < page_cnt; i++)
+    {
+      s->frames[i] = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (s->frames[i] == NULL)
+        {
+          free_segment (s);
+          return -1;
+        }
+    }
+
+  lock_acquire (&shm_lock);
+  id = s->id = next_id++;
+  s->ref_cnt = 1;
+  list_push_back (&segments, &s->elem);
+  if (!add_mapping (s, NULL))
+    {
+      put_segment (s);
+      id = -1;
+    }
+  lock_release (&shm_lock);
+  return id;
+}
+
+/* Maps segment ID read-write into the running process at ADDR,
+   which must be page-aligned and followed by enough unmapped user
+   pages to hold the whole segment.  Returns ADDR, or a null
+   pointer on failure. */
+void *
+shm_map (int id, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct shm_segment *s;
+  uint8_t *upage = addr;
+  size_t mapped = 0;
+  size_t i;
+
+  if (upage == NULL || pg_ofs (upage) != 0)
+    return NULL;
+
+  lock_acquire (&shm_lock);
+  s = find_segment (id);
+  if (s == NULL)
+    {
+      lock_release (&shm_lock);
+      return NULL;
+    }
+  s->ref_cnt++;
+
+  for (i = 0; i < s->page_cnt; i++)
+    {
+      void *page = upage + i * PGSIZE;
+      if (!is_user_vaddr (page) || page < (void *) upage
+          || pagedir_get_page (t->pagedir, page) != NULL
+          || has_page (t->spt, page))
+        goto fail;
+    }
+
+  for (i = 0; i < s->page_cnt; i++)
+    {
+      void *page = upage + i * PGSIZE;
+      struct supp_pt_entry *entry;
+
+      if (!pagedir_set_page (t->pagedir, page, s->frames[i], true))
+        goto fail;
+      mapped = i + 1;
+      entry = install_frame (t->spt, page, s->frames[i]);
+      if (entry == NULL)
+        goto fail;
+      entry->page_status = SHARED;
+      entry->writable = true;
+    }
+
+  if (!add_mapping (s, upage))
+    goto fail;
+  lock_release (&shm_lock);
+  return upage;
+
+ fail:
+  unmap (upage, mapped);
+  put_segment (s);
+  lock_release (&shm_lock);
+  return NULL;
+}
+
+/* Unmaps the segment attached at ADDR in the running process.
+   Returns false if no segment is attached there. */
+bool
+shm_unmap (void *addr)
+{
+  struct list *mappings = &thread_current ()->leader->shm_mappings;
+  struct list_elem *e;
+
+  if (addr == NULL)
+    return false;
+
+  lock_acquire (&shm_lock);
+  for (e = list_begin (mappings); e != list_end (mappings);
+       e = list_next (e))
+    {
+      struct shm_mapping *m = list_entry (e, struct shm_mapping, elem);
+      if (m->upage == addr)
+        {
+          list_remove (&m->elem);
+          unmap (m->upage, m->segment->page_cnt);
+          put_segment (m->segment);
+          lock_release (&shm_lock);
+          free (m);
+          return true;
+        }
+    }
+  lock_release (&shm_lock);
+  return false;
+}
+
+/* Drops every reference the running process holds, including
+   those of the segments it created.  Called by the process's main
+   thread on exit, once its other threads are gone and before the
+   page directory is destroyed. */
+void
+shm_exit (void)
+{
+  struct list *mappings = &thread_current ()->shm_mappings;
+
+  lock_acquire (&shm_lock);
+  while (!list_empty (mappings))
+    {
+      struct list_elem *e = list_pop_front (mappings);
+      struct shm_mapping *m = list_entry (e, struct shm_mapping, elem);
+
+      if (m->upage != NULL)
+        unmap (m->upage, m->segment->page_cnt);
+      put_segment (m->segment);
+      free (m);
+    }
+  lock_release (&shm_lock);
+}
+
+/* Returns the segment with the given ID, or a null pointer.
+   The caller must hold shm_lock. */
+static struct shm_segment *
+find_segment (int id)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&segments); e != list_end (&segments);
+       e = list_next (e))
+    {
+      struct shm_segment *s = list_entry (e, struct shm_segment, elem);
+      if (s->id == id)
+        return s;
+    }
+  return NULL;
+}
+
+/* Drops a reference to S, freeing it if it was the last.  The
+   caller must hold shm_lock. */
+static void
+put_segment (struct shm_segment *s)
+{
+  ASSERT (s->ref_cnt > 0);
+  if (--s->ref_cnt > 0)
+    return;
+
+  list_remove (&s->elem);
+  free_segment (s);
+}
+
+/* Frees S along with whichever of its frames were allocated. */
+static void
+free_segment (struct shm_segment *s)
+{
+  size_t i;
+
+  for (i = 0; i < s->page_cnt; i++)
+    if (s->frames[i] != NULL)
+      palloc_free_page (s->frames[i]);
+  free (s->frames);
+  free (s);
+}
+
+/* Records a reference to S at UPAGE in the running process.  The
+   caller must hold shm_lock. */
+static bool
+add_mapping (struct shm_segment *s, void *upage)
+{
+  struct shm_mapping *m = malloc (sizeof *m);
+
+  if (m == NULL)
+    return false;
+  m->segment = s;
+  m->upage = upage;
+  list_push_back (&thread_current ()->leader->shm_mappings, &m->elem);
+  return true;
+}
+
+/* Removes the PAGE_CNT pages starting at UPAGE from the
+   running process's page directory and supplemental page table,
+   leaving the frames themselves alone. */
+static void
+unmap (void *upage, size_t page_cnt)
+{
+  struct thread *t = thread_current ();
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      void *page = (uint8_t *) upage + i * PGSIZE;
+      pagedir_clear_page (t->pagedir, page);
+      remove_page (t->spt, page);
+    }
+}
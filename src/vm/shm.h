@@ -0,0 +1,13 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void shm_init (void);
+int shm_alloc (size_t size);
+void *shm_map (int id, void *addr);
+bool shm_unmap (void *addr);
+void shm_exit (void);
+
+#endif /* vm/shm.h */